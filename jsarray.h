@@ -90,6 +90,15 @@ public:
         return getElement(index);
     }
 
+    // call f(element, index) for each element, local handles are recycled
+    // every `chunk` elements.
+    template <typename F>
+    JSScopeStats forEach(F&& f, size_t chunk = 1024) const {
+        return for_each_scoped(0, length(), [&](size_t index) {
+            f(getElement(index), index);
+        }, chunk);
+    }
+
 /*  class Accessor final : public JSValue {
     public:
         Accessor& operator=(JSValue value) {
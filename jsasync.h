@@ -0,0 +1,217 @@
+/*
+ * Copyright © 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "jsobject.h"
+#include "jsfunction.h"
+#include "jscallback.h"
+
+namespace jsni {
+
+namespace internal {
+class JSAsyncRequest;
+}
+
+// Base class of the tasks run by JSNativeAsyncFunction/JSNativeAsyncMethod.
+// A task is constructed in the JavaScript thread, where it should copy the
+// arguments into native values, then executed in a worker thread. Finally,
+// the returned promise is settled in the JavaScript thread.
+class JSAsyncTask {
+public:
+    virtual ~JSAsyncTask() = default;
+
+    // called in a worker thread, must not touch any JavaScript value
+    virtual void execute() = 0;
+    // called in the JavaScript thread to resolve the promise
+    virtual JSValue result() {
+        return JSUndefined();
+    }
+
+    // cancellation skips a task which has not started yet, a running task
+    // may poll it and fail() to stop early
+    bool cancelled() const {
+        return cancelled_.load(std::memory_order_relaxed);
+    }
+    void cancel() {
+        cancelled_.store(true, std::memory_order_relaxed);
+    }
+
+protected:
+    // reject the promise with an Error
+    void fail(const std::string& message) {
+        failed_ = true;
+        error_ = message;
+    }
+
+private:
+    std::atomic<bool> cancelled_{false};
+    bool failed_ = false;
+    std::string error_;
+    friend class internal::JSAsyncRequest;
+};
+
+namespace internal {
+
+class JSAsyncRequest final {
+public:
+    static JSValue start(JSAsyncTask* task, JSValue self) {
+        // owned here until the work is queued, complete() deletes it
+        std::unique_ptr<JSAsyncRequest> request(
+                new JSAsyncRequest(task, self));
+        JSNativeObject<JSAsyncRequest> handle(request.get(), 0, nullptr);
+        handle.defineMethod<&JSAsyncRequest::cancel>("cancel");
+
+        auto deferred = deferred_factory()(handle).as(Object);
+        request->deferred_ = JSGlobalValue(deferred);
+        request->handle_ = JSGlobalValue(handle);
+        AsyncThreadWork(env(), request.get(), execute, complete);
+        request.release();
+        return deferred.getProperty("promise");
+    }
+
+    // promise.cancel()
+    JSValue cancel(JSObject, JSArray) {
+        task_->cancel();
+        return JSUndefined();
+    }
+
+private:
+    JSAsyncRequest(JSAsyncTask* task, JSValue self):
+        task_(task), self_(self) {}
+
+    static void execute(JSNIEnv*, void* data) {
+        auto request = reinterpret_cast<JSAsyncRequest*>(data);
+        auto task = request->task_.get();
+        if (task->cancelled())  return;
+        request->executed_ = true;
+#if __cpp_exceptions || __EXCEPTIONS
+        try {
+            task->execute();
+        } catch (const std::exception& e) {
+            task->fail(e.what());
+        } catch (...) {
+            task->fail("unknown native exception");
+        }
+#else
+        task->execute();
+#endif
+    }
+    static void complete(JSNIEnv*, void* data) {
+        std::unique_ptr<JSAsyncRequest> request(
+                reinterpret_cast<JSAsyncRequest*>(data));
+        auto task = request->task_.get();
+
+        guard([&] {
+            // promise.cancel() is a no-op from now on
+            JSNativeObject<JSAsyncRequest>(request->handle_).reset(nullptr);
+
+            // a task cancelled while it was running is rejected as
+            // cancelled only if it has failed, e.g. by stopping early
+            JSObject deferred = request->deferred_;
+            if (!request->executed_ || (task->failed_ && task->cancelled()))
+                deferred["reject"].as(Function)("cancelled");
+            else if (task->failed_)
+                deferred["reject"].as(Function)(task->error_);
+            else
+                deferred["resolve"].as(Function)(task->result());
+        });
+    }
+
+    static JSFunction deferred_factory() {
+        auto& factory = environment_local<JSGlobalValue, JSAsyncRequest>();
+        if (!factory)  factory = JSGlobalValue(JSFunction("handle",
+            "var d = {};"
+            "d.promise = new Promise(function(resolve, reject) {"
+            "  d.resolve = resolve;"
+            "  d.reject = function(msg) { reject(new Error(msg)); };"
+            "});"
+            "d.promise.cancel = function() { handle.cancel(); };"
+            "return d;"));
+        return factory;
+    }
+
+    std::unique_ptr<JSAsyncTask> task_;
+    JSGlobalValue self_;  // keep the receiver alive
+    JSGlobalValue deferred_;
+    JSGlobalValue handle_;
+    bool executed_ = false;
+};
+
+}
+
+// Native function which returns a promise. T is derived from JSAsyncTask
+// and has a constructor of T(JSObject self, JSArray args).
+template <class T>
+class JSNativeAsyncFunction : public JSFunction {
+    static_assert(std::is_base_of<JSAsyncTask, T>::value, "");
+public:
+    JSNativeAsyncFunction(): JSFunction(cached(thunk)) {}
+
+    JSNativeAsyncFunction(const std::string& name): JSFunction(cached(thunk, name)) {}
+
+private:
+    static void thunk(JSNIEnv* env, const JSNICallbackInfo info) {
+        assert(env == JSValue::env);
+        internal::guard([&] {
+            JSObject self = JSNIGetThisOfCallback(env, info);
+            auto task = new T(self, info);
+            JSNISetReturnValue(env, info,
+                               internal::JSAsyncRequest::start(task, self));
+        });
+    }
+};
+
+// Native method which returns a promise. Task is derived from JSAsyncTask
+// and has a constructor of Task(T& native, JSObject self, JSArray args).
+// The receiver is kept alive until the promise is settled.
+template <class T, class Task>
+class JSNativeAsyncMethod : public JSFunction {
+    static_assert(std::is_base_of<JSAsyncTask, Task>::value, "");
+public:
+    JSNativeAsyncMethod(): JSFunction(cached(thunk)) {}
+
+    JSNativeAsyncMethod(const std::string& name): JSFunction(cached(thunk, name)) {}
+
+private:
+    static void thunk(JSNIEnv* env, const JSNICallbackInfo info) {
+        assert(env == JSValue::env);
+        internal::guard([&] {
+            JSNativeObject<T> self(JSNIGetThisOfCallback(env, info));
+            T* native = self.native();
+            if (!native)
+                return internal::illegal_invocation();
+            auto task = new Task(*native, self, info);
+            JSNISetReturnValue(env, info,
+                               internal::JSAsyncRequest::start(task, self));
+        });
+    }
+};
+
+}
@@ -0,0 +1,463 @@
+/*
+ * Copyright © 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <cmath>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "jsvalue.h"
+#include "jsprimitive.h"
+#include "jsobject.h"
+#include "jsarray.h"
+#include "jsfunction.h"
+#include "jstypedarray.h"
+
+namespace jsni {
+
+// Compact binary format of a JS value graph. Every value starts with a tag
+// byte. Integers and lengths are varints, doubles are raw 8 bytes. Objects
+// seen before are written as back-references, so cycles and shared objects
+// are preserved. Typed array data is copied in bulk and aligned to 8 bytes
+// from the beginning of the stream, so it can be borrowed from a mapped
+// file when decoding. Numbers use the byte order of the host.
+namespace internal {
+
+enum JSBinaryTag : uint8_t {
+    BinaryUndefined,
+    BinaryNull,
+    BinaryFalse,
+    BinaryTrue,
+    BinaryInt,
+    BinaryDouble,
+    BinaryString,
+    BinaryArray,
+    BinaryObject,
+    BinaryTypedArray,
+    BinaryReference,
+};
+
+static const char binary_magic[4] = { 'J', 'S', 'N', 'B' };
+static const uint8_t binary_version = 1;
+
+inline size_t typed_array_element_size(JsTypedArrayType type) {
+    switch (type) {
+        case JsArrayTypeInt16:
+        case JsArrayTypeUint16:  return 2;
+        case JsArrayTypeInt32:
+        case JsArrayTypeUint32:
+        case JsArrayTypeFloat32: return 4;
+        case JsArrayTypeFloat64: return 8;
+        default:                 return 1;
+    }
+}
+
+}
+
+class JSBinaryWriter final {
+public:
+    typedef std::function<void(const char* data, size_t size)> Sink;
+
+    // output is passed to the sink whenever 'capacity' bytes are buffered
+    explicit JSBinaryWriter(Sink sink, size_t capacity = 64 * 1024):
+        sink_(std::move(sink)), capacity_(capacity) {
+        buffer_.reserve(capacity_);
+        bytes(internal::binary_magic, sizeof(internal::binary_magic));
+        byte(internal::binary_version);
+    }
+    ~JSBinaryWriter() {
+        flush();
+    }
+    JSBinaryWriter(const JSBinaryWriter&) = delete;
+    JSBinaryWriter& operator =(const JSBinaryWriter&) = delete;
+
+    // each value is self-contained, references do not cross values
+    void write(JSValue value) {
+        seen_ = JSGlobalValue();
+        objects_ = 0;
+        encode(value);
+    }
+
+    void flush() {
+        if (buffer_.empty())  return;
+        sink_(buffer_.data(), buffer_.size());
+        flushed_ += buffer_.size();
+        buffer_.clear();
+    }
+    // total bytes written, including buffered ones
+    size_t size() const {
+        return flushed_ + buffer_.size();
+    }
+
+private:
+    void encode(JSValue value) {
+        JSNIEnv* env = jsni::env();
+        JSValueRef jsval = value;
+        if (JSNIIsUndefined(env, jsval) || JSNIIsFunction(env, jsval) ||
+            JSNIIsSymbol(env, jsval)) {
+            byte(internal::BinaryUndefined);
+        } else if (JSNIIsNull(env, jsval)) {
+            byte(internal::BinaryNull);
+        } else if (JSNIIsBoolean(env, jsval)) {
+            byte(JSNIToCBool(env, jsval) ?
+                 internal::BinaryTrue : internal::BinaryFalse);
+        } else if (JSNIIsNumber(env, jsval)) {
+            number(JSNIToCDouble(env, jsval));
+        } else if (JSNIIsString(env, jsval)) {
+            byte(internal::BinaryString);
+            string(jsval);
+        } else if (JSNIIsObject(env, jsval)) {
+            JSScope scope;
+            JSValue index = reference(jsval);
+            if (!index.is(Undefined)) {
+                byte(internal::BinaryReference);
+                varint(static_cast<uint64_t>(JSNIToCDouble(env, index)));
+            } else if (JSNIIsTypedArray(env, jsval)) {
+                typedArray(jsval);
+            } else if (JSNIIsArray(env, jsval)) {
+                size_t length = JSNIGetArrayLength(env, jsval);
+                byte(internal::BinaryArray);
+                varint(length);
+                for (size_t i = 0; i < length; ++i) {
+                    JSScope scope;
+                    encode(JSNIGetArrayElement(env, jsval, i));
+                }
+            } else {
+                JSObject object = JSValue(jsval).as(Object);
+                JSArray keys = object.keys();
+                size_t length = keys.length();
+                byte(internal::BinaryObject);
+                varint(length);
+                for (size_t i = 0; i < length; ++i) {
+                    JSScope scope;
+                    JSValueRef key = keys.getElement(i);
+                    string(key);
+                    std::string name = JSValue(key).as(String);
+                    encode(JSNIGetProperty(env, jsval, name.c_str()));
+                }
+            }
+        } else {
+            byte(internal::BinaryUndefined);
+        }
+    }
+
+    // index of an object written before, or undefined. The identity map
+    // is a JS Map because JSNI has no way to compare object identity.
+    JSValue reference(JSValueRef object) {
+        auto& lookup = internal::environment_local<JSGlobalValue,
+                                                   JSBinaryWriter>();
+        if (!lookup) {
+            lookup = JSGlobalValue(JSFunction("m, o, i",
+                "var r = m.get(o);"
+                "if (r === undefined) m.set(o, i);"
+                "return r;"));
+        }
+        if (!seen_) {
+            seen_ = JSGlobalValue(JSFunction("", "return new Map();")());
+        }
+        JSFunction func = lookup;
+        JSValue map = seen_;
+        JSValue index = func(map, JSValue(object), JSNumber(objects_));
+        if (index.is(Undefined))  ++objects_;
+        return index;
+    }
+
+    void number(double value) {
+        int32_t i = value >= INT32_MIN && value <= INT32_MAX ?
+                    static_cast<int32_t>(value) : 0;
+        if (static_cast<double>(i) == value && (i || !std::signbit(value))) {
+            byte(internal::BinaryInt);
+            varint((static_cast<uint32_t>(i) << 1) ^
+                   static_cast<uint32_t>(i >> 31));
+        } else {
+            byte(internal::BinaryDouble);
+            bytes(reinterpret_cast<const char*>(&value), sizeof(value));
+        }
+    }
+    void string(JSValueRef jsval) {
+        JSNIEnv* env = jsni::env();
+        size_t length = JSNIGetStringUtf8Length(env, jsval);
+        varint(length);
+        reserve(length + 1);
+        size_t offset = buffer_.size();
+        buffer_.resize(offset + length + 1);
+        JSNIGetStringUtf8Chars(env, jsval, &buffer_[offset], length + 1);
+        buffer_.resize(offset + length);
+        spill();
+    }
+    void typedArray(JSValueRef jsval) {
+        JSNIEnv* env = jsni::env();
+        JsTypedArrayType type = JSNIGetTypedArrayType(env, jsval);
+        size_t length = JSNIGetTypedArrayLength(env, jsval);
+        byte(internal::BinaryTypedArray);
+        byte(static_cast<uint8_t>(type));
+        varint(length);
+        static const char zeros[8] = {};
+        bytes(zeros, (8 - size() % 8) % 8);
+        bytes(reinterpret_cast<const char*>(JSNIGetTypedArrayData(env, jsval)),
+              length * internal::typed_array_element_size(type));
+    }
+
+    void byte(uint8_t value) {
+        buffer_.push_back(static_cast<char>(value));
+        spill();
+    }
+    void varint(uint64_t value) {
+        char buf[10];
+        size_t n = 0;
+        do {
+            uint8_t b = value & 0x7f;
+            value >>= 7;
+            buf[n++] = static_cast<char>(value ? b | 0x80 : b);
+        } while (value);
+        bytes(buf, n);
+    }
+    void bytes(const char* data, size_t size) {
+        if (buffer_.size() + size > capacity_) {
+            flush();
+            if (size > capacity_) {
+                // pass large blocks through without copying
+                sink_(data, size);
+                flushed_ += size;
+                return;
+            }
+        }
+        buffer_.append(data, size);
+    }
+    void reserve(size_t size) {
+        if (buffer_.size() + size > capacity_)  flush();
+    }
+    void spill() {
+        if (buffer_.size() >= capacity_)  flush();
+    }
+
+    Sink sink_;
+    size_t capacity_;
+    size_t flushed_ = 0;
+    std::string buffer_;
+    JSGlobalValue seen_;
+    size_t objects_ = 0;
+};
+
+class JSBinaryReader final {
+public:
+    // With 'borrow', typed arrays refer to the input directly instead of
+    // owning a copy, and the input must outlive them (e.g. a mapped file).
+    JSBinaryReader(const char* data, size_t size, bool borrow = false):
+        begin_(data), cursor_(data), end_(data + size), borrow_(borrow) {
+        failed_ = size < sizeof(internal::binary_magic) + 1 ||
+                  memcmp(data, internal::binary_magic,
+                         sizeof(internal::binary_magic)) ||
+                  data[sizeof(internal::binary_magic)] !=
+                      internal::binary_version;
+        cursor_ += sizeof(internal::binary_magic) + 1;
+    }
+
+    // undefined if the input is malformed
+    JSValue read() {
+        if (failed_)  return JSUndefined();
+        JSEscapableScope scope;
+        objects_ = JSArray();
+        count_ = 0;
+        return scope.escape(value());
+    }
+    bool failed() const {
+        return failed_;
+    }
+
+private:
+    JSValue value() {
+        JSNIEnv* env = jsni::env();
+        uint8_t tag;
+        if (!byte(tag))  return fail();
+        switch (tag) {
+            case internal::BinaryUndefined:
+                return JSNINewUndefined(env);
+            case internal::BinaryNull:
+                return JSNINewNull(env);
+            case internal::BinaryFalse:
+            case internal::BinaryTrue:
+                return JSNINewBoolean(env, tag == internal::BinaryTrue);
+            case internal::BinaryInt: {
+                uint64_t v;
+                if (!varint(v))  return fail();
+                int32_t i = static_cast<int32_t>((v >> 1) ^ (~(v & 1) + 1));
+                return JSNINewNumber(env, i);
+            }
+            case internal::BinaryDouble: {
+                double d;
+                if (!bytes(&d, sizeof(d)))  return fail();
+                return JSNINewNumber(env, d);
+            }
+            case internal::BinaryString:
+                return string();
+            case internal::BinaryReference: {
+                uint64_t index;
+                if (!varint(index) || index >= count_)  return fail();
+                return JSNIGetArrayElement(env, objects_, index);
+            }
+            case internal::BinaryArray: {
+                uint64_t length;
+                if (!varint(length) || length > size_t(end_ - cursor_))
+                    return fail();
+                JSArray array(length);
+                remember(array);
+                for (size_t i = 0; i < length; ++i) {
+                    JSScope scope;
+                    JSValue element = value();
+                    if (failed_)  return fail();
+                    array.setElement(i, element);
+                }
+                return array;
+            }
+            case internal::BinaryObject: {
+                uint64_t length;
+                if (!varint(length) || length > size_t(end_ - cursor_))
+                    return fail();
+                JSObject object;
+                remember(object);
+                std::string name;
+                for (size_t i = 0; i < length; ++i) {
+                    JSScope scope;
+                    uint64_t len;
+                    if (!varint(len) || len > size_t(end_ - cursor_))
+                        return fail();
+                    name.assign(cursor_, len);
+                    cursor_ += len;
+                    JSValue property = value();
+                    if (failed_)  return fail();
+                    JSNISetProperty(env, object, name.c_str(), property);
+                }
+                return object;
+            }
+            case internal::BinaryTypedArray:
+                return typedArray();
+            default:
+                return fail();
+        }
+    }
+
+    JSValue string() {
+        uint64_t len;
+        if (!varint(len) || len > size_t(end_ - cursor_))  return fail();
+        JSValueRef jsval = JSNINewStringFromUtf8(env(), cursor_, len);
+        cursor_ += len;
+        return jsval;
+    }
+    JSValue typedArray() {
+        uint8_t type;
+        uint64_t length;
+        if (!byte(type) || !varint(length))  return fail();
+        if (type < JsArrayTypeInt8 || type > JsArrayTypeFloat64)
+            return fail();
+        size_t pad = (8 - (cursor_ - begin_) % 8) % 8;
+        if (pad > size_t(end_ - cursor_))  return fail();
+        cursor_ += pad;
+        auto jstype = static_cast<JsTypedArrayType>(type);
+        size_t elemsize = internal::typed_array_element_size(jstype);
+        if (length > size_t(end_ - cursor_) / elemsize)  return fail();
+        size_t size = length * elemsize;
+        void* data = const_cast<char*>(cursor_);
+        cursor_ += size;
+        JSValue array;
+        // padding is relative to the stream, so only an aligned input
+        // can be borrowed
+        if (borrow_ && reinterpret_cast<uintptr_t>(data) % elemsize == 0) {
+            array = JSNINewTypedArray(env(), jstype, data, length);
+        } else {
+            // never empty, an empty array gets a buffer too
+            auto copy = new std::vector<uint64_t>(size / 8 + 1);
+            memcpy(copy->data(), data, size);
+            array = JSNINewTypedArray(env(), jstype, copy->data(), length);
+            JSGlobalValue(array).setGCCallback([copy]() { delete copy; });
+        }
+        remember(array);
+        return array;
+    }
+
+    void remember(JSValueRef object) {
+        JSNISetArrayElement(env(), objects_, count_++, object);
+    }
+    bool byte(uint8_t& value) {
+        return bytes(&value, 1);
+    }
+    bool varint(uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t b;
+            if (!byte(b))  return false;
+            value |= uint64_t(b & 0x7f) << shift;
+            if (!(b & 0x80))  return true;
+        }
+        failed_ = true;
+        return false;
+    }
+    bool bytes(void* data, size_t size) {
+        if (size > size_t(end_ - cursor_)) {
+            failed_ = true;
+            return false;
+        }
+        memcpy(data, cursor_, size);
+        cursor_ += size;
+        return true;
+    }
+    JSValue fail() {
+        failed_ = true;
+        return JSUndefined();
+    }
+
+    const char* begin_;
+    const char* cursor_;
+    const char* end_;
+    bool borrow_;
+    bool failed_;
+    JSArray objects_;
+    size_t count_ = 0;
+};
+
+// One-shot helpers
+class JSBinary final {
+public:
+    static std::string encode(JSValue value) {
+        std::string result;
+        {
+            JSBinaryWriter writer([&result](const char* data, size_t size) {
+                result.append(data, size);
+            });
+            writer.write(value);
+        }
+        return result;
+    }
+    static JSValue decode(const std::string& data) {
+        return JSBinaryReader(data.data(), data.size()).read();
+    }
+};
+
+}
@@ -0,0 +1,176 @@
+/*
+ * Copyright © 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
+#include "jsvalue.h"
+
+namespace jsni {
+
+// LRU cache of JavaScript values keyed by native keys. Entries are evicted
+// when either the count of entries or the estimated bytes exceeds the limit,
+// a limit of 0 entries disables caching. A weak entry doesn't keep its value
+// alive, it's dropped before the next insertion or statistics read after
+// the value is garbage collected.
+template <typename Key, typename Hash = std::hash<Key>>
+class JSPersistentCache {
+public:
+    struct Stats {
+        size_t hits;
+        size_t misses;
+        size_t evictions;
+        size_t entries;
+        size_t bytes;
+    };
+
+    explicit JSPersistentCache(size_t max_entries,
+                               size_t max_bytes = SIZE_MAX):
+        max_entries_(max_entries), max_bytes_(max_bytes),
+        stats_ { 0, 0, 0, 0, 0 }, collected_(std::make_shared<size_t>(0)) {}
+    JSPersistentCache(const JSPersistentCache&) = delete;
+    JSPersistentCache& operator =(const JSPersistentCache&) = delete;
+
+    // returns an empty value if not found
+    JSValue get(const Key& key) {
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            JSValue value = it->second->value();
+            if (value) {
+                lru_.splice(lru_.begin(), lru_, it->second);
+                ++stats_.hits;
+                return value;
+            }
+            remove(it->second);  // weak value was collected
+        }
+        ++stats_.misses;
+        return JSValue();
+    }
+
+    // returns cached value or the one created by make()
+    template <typename F>
+    JSValue get(const Key& key, F&& make, size_t bytes = 0,
+                bool weak = false) {
+        JSValue value = get(key);
+        if (!value) {
+            value = make();
+            put(key, value, bytes, weak);
+        }
+        return value;
+    }
+
+    void put(const Key& key, JSValue value, size_t bytes = 0,
+             bool weak = false) {
+        auto it = index_.find(key);
+        if (it != index_.end())
+            remove(it->second);
+        if (max_entries_ == 0)  return;
+        purge();
+
+        lru_.emplace_front(key, value, bytes, weak, collected_);
+        index_.emplace(key, lru_.begin());
+        ++stats_.entries;
+        stats_.bytes += bytes;
+        while (!lru_.empty() && (stats_.entries > max_entries_ ||
+                                 stats_.bytes > max_bytes_)) {
+            remove(std::prev(lru_.end()));
+            ++stats_.evictions;
+        }
+    }
+
+    bool erase(const Key& key) {
+        auto it = index_.find(key);
+        if (it == index_.end())  return false;
+        remove(it->second);
+        return true;
+    }
+    void clear() {
+        lru_.clear();
+        index_.clear();
+        stats_.entries = stats_.bytes = 0;
+    }
+
+    const Stats& stats() {
+        purge();
+        return stats_;
+    }
+
+    // drop the weak entries whose values have been garbage collected
+    void purge() {
+        if (*collected_ == 0)  return;
+        *collected_ = 0;
+        for (auto it = lru_.begin(); it != lru_.end();) {
+            auto entry = it++;
+            if (!entry->strong && entry->weak.expired())
+                remove(entry);
+        }
+    }
+
+private:
+    struct Entry {
+        Entry(const Key& key, JSValue value, size_t bytes, bool is_weak,
+              const std::shared_ptr<size_t>& collected):
+            key(key), bytes(bytes) {
+            // counted by the GC callback, removed later by purge()
+            if (is_weak)
+                weak = JSWeakValue(value, [collected]() { ++*collected; });
+            else
+                strong = JSGlobalValue(value);
+        }
+        JSValue value() const {
+            if (!strong)  return weak.lock();
+            JSValue value = strong;
+            return value;
+        }
+
+        Key key;
+        size_t bytes;
+        JSGlobalValue strong;
+        JSWeakValue weak;
+    };
+    typedef typename std::list<Entry>::iterator iterator;
+
+    void remove(iterator it) {
+        --stats_.entries;
+        stats_.bytes -= it->bytes;
+        index_.erase(it->key);
+        lru_.erase(it);
+    }
+
+    size_t max_entries_;
+    size_t max_bytes_;
+    std::list<Entry> lru_;
+    std::unordered_map<Key, iterator, Hash> index_;
+    Stats stats_;
+    std::shared_ptr<size_t> collected_;  // outlives the cache in callbacks
+};
+
+}
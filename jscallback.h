@@ -25,9 +25,6 @@
  */
 #pragma once
 
-#include <unistd.h>
-#include <sys/syscall.h>
-
 #include <future>
 #include <tuple>
 
@@ -35,15 +32,6 @@
 #include "jsobject.h"
 #include "jsfunction.h"
 
-//#include <JSNIHelper.h>
-extern "C" {
-typedef void (*AsyncThreadWorkCallback)(JSNIEnv* env, void*);
-typedef void (*AsyncThreadWorkAfterCallback)(JSNIEnv* env, void*);
-void AsyncThreadWork(JSNIEnv* env, void* data,
-                     AsyncThreadWorkCallback work,
-                     AsyncThreadWorkAfterCallback callback);
-}
-
 #if !defined(__cpp_generic_lambdas)
 #error "C++ generic lambdas support requires G++ 4.9 / clang 3.4 or later"
 #endif
@@ -63,8 +51,9 @@ public:
 protected:
     JSCallbackBase(JSGlobalValue jsfunc = nullptr): jsfunc_(jsfunc) {}
 
-    static bool is_safe() {
-        return syscall(SYS_gettid) == getpid();
+    // the function can be called directly only in its own environment
+    bool is_safe() const {
+        return jsfunc_.environment() == env();
     }
 
     //JSGlobalValue jsobj_;
@@ -115,13 +104,15 @@ public:
             return call(std::forward<Us>(args)...);
 
         args_ = std::move(std::make_tuple(args...));
-        AsyncThreadWork(NULL, this, [](JSNIEnv*, void*){}, callback);
+        AsyncThreadWork(this->jsfunc_.environment(), this,
+                        [](JSNIEnv*, void*){}, callback);
         return result_.get_future().get();
     }
 
 private:
     static void callback(JSNIEnv* env, void* data) {
         auto self = reinterpret_cast<JSCallback<R, Ts...>*>(data);
+        JSEnvironmentScope scope(env);
         auto call = [self](auto&&... args) -> JSValue {
             return self->call(std::forward<decltype(args)>(args)...);
         };
@@ -140,7 +131,8 @@ public:
     void operator()(Us&&... args) {
         assert(self_ == this);  // object must be allocated in heap
         args_ = std::make_tuple(args...);
-        AsyncThreadWork(NULL, this, [](JSNIEnv*, void*){}, callback);
+        AsyncThreadWork(this->jsfunc_.environment(), this,
+                        [](JSNIEnv*, void*){}, callback);
     }
 
 #ifndef NDEBUG
@@ -154,6 +146,7 @@ public:
 private:
     static void callback(JSNIEnv* env, void* data) {
         auto self = reinterpret_cast<JSCallback<void, Ts...>*>(data);
+        JSEnvironmentScope scope(env);
         auto call = [self](auto&&... args) {
             self->call(std::forward<decltype(args)>(args)...);
         };
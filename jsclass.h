@@ -0,0 +1,302 @@
+/*
+ * Copyright © 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+
+#include <cassert>
+#include <map>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+
+#include "jsobject.h"
+#include "jsfunction.h"
+#include "jsconstructor.h"
+
+namespace jsni {
+
+// An entry of a class binding spec. Entries are literal values, so a spec
+// can be a constexpr table, e.g.
+//   constexpr JSClassMember<Echo> echo_members[] = {
+//       JSClassMember<Echo>::method<&Echo::echo>("echo"),
+//       JSClassMember<Echo>::property<&Echo::prefix>("prefix"),
+//       JSClassMember<Echo>::constant("VERSION", 1),
+//   };
+template <class T>
+struct JSClassMember {
+    enum Kind {
+        Method,
+        Accessor,
+        Number,
+        String
+    };
+
+    template <JSMethodType<T> function>
+    static constexpr JSClassMember method(
+            const char* name, JSNIPropertyAttributes attributes = JSNINone) {
+        return JSClassMember(Method, name, attributes,
+                             JSNativeMethod<T, function>::thunk);
+    }
+    // static method of the constructor
+    template <JSFunctionType function>
+    static constexpr JSClassMember staticMethod(
+            const char* name, JSNIPropertyAttributes attributes = JSNINone) {
+        return JSClassMember(Method, name, attributes,
+                             JSNativeFunction<function>::thunk);
+    }
+    template <JSGetterType<T> getter, JSSetterType<T> setter = nullptr>
+    static constexpr JSClassMember property(
+            const char* name, JSNIPropertyAttributes attributes = JSNINone) {
+        return JSClassMember(Accessor, name, attributes,
+                             JSNativeGetter<T, getter>::thunk,
+                             setter != nullptr ?
+                                 JSNativeSetter<T, setter>::thunk : nullptr);
+    }
+    template <JSAccessorType<T> accessor>
+    static constexpr JSClassMember property(
+            const char* name, JSNIPropertyAttributes attributes = JSNINone) {
+        return JSClassMember(Accessor, name, attributes,
+                             JSNativeAccessor<T, accessor>::thunk,
+                             JSNativeAccessor<T, accessor>::thunk);
+    }
+    static constexpr JSClassMember constant(
+            const char* name, double value,
+            JSNIPropertyAttributes attributes = read_only) {
+        return JSClassMember(Number, name, attributes,
+                             nullptr, nullptr, value);
+    }
+    static constexpr JSClassMember constant(
+            const char* name, const char* value,
+            JSNIPropertyAttributes attributes = read_only) {
+        return JSClassMember(String, name, attributes,
+                             nullptr, nullptr, 0, value);
+    }
+
+    Kind kind;
+    const char* name;
+    JSNIPropertyAttributes attributes;
+    JSNICallback first;     // method or getter
+    JSNICallback second;    // setter
+    double number;
+    const char* string;
+
+private:
+    static constexpr JSNIPropertyAttributes read_only =
+        static_cast<JSNIPropertyAttributes>(JSNIReadOnly | JSNIDontDelete);
+
+    constexpr JSClassMember(Kind kind, const char* name,
+                            JSNIPropertyAttributes attributes,
+                            JSNICallback first, JSNICallback second = nullptr,
+                            double number = 0, const char* string = nullptr):
+        kind(kind), name(name), attributes(attributes),
+        first(first), second(second), number(number), string(string) {}
+};
+
+// A table of class members applied in a single pass with raw JSNI calls.
+template <class T>
+class JSClassSpec final {
+public:
+    constexpr JSClassSpec(): members_(nullptr), count_(0) {}
+    template <size_t N>
+    constexpr JSClassSpec(const JSClassMember<T> (&members)[N]):
+        members_(members), count_(N) {}
+
+    size_t size() const {
+        return count_;
+    }
+    const JSClassMember<T>* data() const {
+        return members_;
+    }
+
+    // define all members on the object
+    bool apply(JSObject target) const {
+        JSNIEnv* env = jsni::env();
+        bool ok = true;
+        JSScope scope;
+        for (size_t i = 0; i < count_; ++i) {
+            const JSClassMember<T>& member = members_[i];
+            switch (member.kind) {
+                case JSClassMember<T>::Method:
+                    if (member.attributes == JSNINone) {
+                        ok &= JSNIRegisterMethod(env, target, member.name,
+                                                 member.first);
+                    } else {
+                        JSNIDataPropertyDescriptor desc {
+                            JSNINewFunction(env, member.first),
+                            member.attributes
+                        };
+                        ok &= JSNIDefineProperty(env, target, member.name,
+                                                 {&desc, nullptr});
+                    }
+                    break;
+                case JSClassMember<T>::Accessor: {
+                    JSNIAccessorPropertyDescriptor desc {
+                        member.first, member.second, member.attributes, nullptr
+                    };
+                    ok &= JSNIDefineProperty(env, target, member.name,
+                                             {nullptr, &desc});
+                    break;
+                }
+                default: {
+                    JSNIDataPropertyDescriptor desc {
+                        member.kind == JSClassMember<T>::Number ?
+                            JSNINewNumber(env, member.number) :
+                            JSNINewStringFromUtf8(env, member.string,
+                                                  strlen(member.string)),
+                        member.attributes
+                    };
+                    ok &= JSNIDefineProperty(env, target, member.name,
+                                             {&desc, nullptr});
+                }
+            }
+        }
+        return ok;
+    }
+
+    // The prototype is built once per environment and member table, later
+    // constructors from the same table in the same environment share it.
+    JSNativeConstructor<T> constructor(const std::string& name = "") const {
+        auto& proto = prototypes()[members_];
+        if (!proto) {
+            JSNativeObject<T> object(nullptr);
+            apply(object);
+            proto = JSGlobalValue(object);
+        }
+        JSValue object = proto;
+        return JSNativeConstructor<T>(name, JSNativeObject<T>(object));
+    }
+
+private:
+    using Prototypes = std::unordered_map<const JSClassMember<T>*,
+                                          JSGlobalValue>;
+    static Prototypes& prototypes() {
+        return internal::environment_local<Prototypes, JSClassSpec>();
+    }
+
+    const JSClassMember<T>* members_;
+    size_t count_;
+};
+
+template <class T>
+constexpr JSNIPropertyAttributes JSClassMember<T>::read_only;
+
+namespace internal {
+
+// Base* converts to T* with static_cast, so Base is neither virtual nor
+// ambiguous, and T* converts to Base* by a fixed offset. True for void.
+template <class Base, class T, typename = void>
+struct is_static_base_of : std::false_type {};
+template <class Base, class T>
+struct is_static_base_of<Base, T, decltype(void(
+        static_cast<T*>(std::declval<Base*>())))> : std::true_type {};
+
+}
+
+// Class binding with prototype members, static members of the constructor
+// and an optional native base class. The prototype of a derived class
+// inherits the prototype of the base class, so the base class must be
+// defined first in the environment. Methods of the base class read the
+// native of a T wrapper as a Base*, so the Base subobject must be at the
+// start of T: this is checked at compile time for standard layout classes,
+// and when the class is defined for polymorphic ones. Everything is
+// registered in one pass, once per environment, spec and name.
+template <class T, class Base = void>
+class JSNativeClass final {
+    static_assert(std::is_void<Base>::value ||
+                  std::is_base_of<Base, T>::value, "");
+    static_assert(internal::is_static_base_of<Base, T>::value,
+                  "Base must be a unique non-virtual base class of T");
+    static_assert(std::is_void<Base>::value ||
+                  (std::is_polymorphic<T>::value ?
+                   std::is_polymorphic<Base>::value :
+                   std::is_standard_layout<T>::value),
+                  "the Base subobject may not be at the start of T");
+public:
+    constexpr JSNativeClass(JSClassSpec<T> members,
+                            JSClassSpec<T> statics = JSClassSpec<T>()):
+        members_(members), statics_(statics) {}
+
+    // name defaults to the name of T
+    JSFunction define(const std::string& name = "") const {
+        auto& ctor = constructors()[
+            std::make_tuple(members_.data(), statics_.data(), name)];
+        if (!ctor) {
+            if (!base_at_start(std::is_void<Base>())) {
+                JSException::raise(JSException::TypeError,
+                                   "Native base class is not at the start");
+                return nullptr;
+            }
+            JSScope scope;
+            JSNativeObject<T> proto(nullptr);
+            members_.apply(proto);
+            link(proto, std::is_void<Base>());
+            JSNativeConstructor<T> func(name, proto);
+            statics_.apply(func);
+            ctor = JSGlobalValue(func);
+        }
+        JSFunction func = ctor;
+        return func;
+    }
+
+private:
+    static bool base_at_start(std::true_type) {
+        return true;
+    }
+    static bool base_at_start(std::false_type) {
+        // the conversion to a non-virtual base is an address adjustment
+        alignas(T) static char storage[sizeof(T)];
+        auto derived = reinterpret_cast<T*>(storage);
+        return static_cast<void*>(static_cast<Base*>(derived)) == storage;
+    }
+
+    static void link(JSObject, std::true_type) {}
+    static void link(JSObject proto, std::false_type) {
+#ifdef CHECK_NATIVE_TYPE
+        internal::native_bases()[typeid(T).hash_code()] =
+            typeid(Base).hash_code();
+#endif
+        JSValue base = JSNativeConstructor<
+            typename std::conditional<std::is_void<Base>::value,
+                                      T, Base>::type>::classPrototype();
+        assert(base.is(Object));
+        if (base.is(Object))
+            proto.setPrototype(base.as(Object));
+    }
+    using Key = std::tuple<const JSClassMember<T>*,
+                           const JSClassMember<T>*, std::string>;
+    static std::map<Key, JSGlobalValue>& constructors() {
+        return internal::environment_local<std::map<Key, JSGlobalValue>,
+                                           JSNativeClass>();
+    }
+
+    JSClassSpec<T> members_;
+    JSClassSpec<T> statics_;
+};
+
+}
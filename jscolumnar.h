@@ -0,0 +1,135 @@
+/*
+ * Copyright © 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "jsobject.h"
+#include "jsarray.h"
+#include "jstypedarray.h"
+
+namespace jsni {
+
+namespace internal {
+
+// element type of the typed array for a numeric field
+template <typename T, size_t size = sizeof(T),
+          bool is_signed = std::is_signed<T>::value>
+struct column_element {
+    typedef double type;
+};
+template <typename T>
+struct column_element<T, 1, true> { typedef int8_t type; };
+template <typename T>
+struct column_element<T, 1, false> { typedef uint8_t type; };
+template <typename T>
+struct column_element<T, 2, true> { typedef int16_t type; };
+template <typename T>
+struct column_element<T, 2, false> { typedef uint16_t type; };
+template <typename T>
+struct column_element<T, 4, true> {
+    typedef typename std::conditional<
+        std::is_floating_point<T>::value, float, int32_t>::type type;
+};
+template <typename T>
+struct column_element<T, 4, false> { typedef uint32_t type; };
+
+}
+
+// Export of records as columns. Each numeric field is transposed into a
+// typed array which takes over the native buffer. Each string field is
+// encoded as a dictionary of unique strings and a Uint32Array of indexes.
+//
+//   auto exporter = JSColumnExporter<Row>()
+//       .numeric("price", &Row::price)
+//       .dictionary("symbol", &Row::symbol);
+//   JSObject table = exporter(rows);
+//   // { length: n, price: Float64Array, symbol: { values: [], codes: Uint32Array } }
+template <class T>
+class JSColumnExporter {
+public:
+    template <typename M>
+    JSColumnExporter& numeric(const std::string& name, M T::*member) {
+        static_assert(std::is_arithmetic<M>::value, "");
+        typedef typename internal::column_element<M>::type E;
+        columns_.emplace_back(name, [member](const std::vector<T>& rows) {
+            std::vector<E> column;
+            column.reserve(rows.size());
+            for (auto&& row: rows)
+                column.push_back(static_cast<E>(row.*member));
+            return JSValue(JSTypedArray<E>(std::move(column)));
+        });
+        return *this;
+    }
+
+    JSColumnExporter& dictionary(const std::string& name,
+                                 std::string T::*member) {
+        columns_.emplace_back(name, [member](const std::vector<T>& rows) {
+            std::unordered_map<std::string, uint32_t> index;
+            std::vector<const std::string*> values;
+            std::vector<uint32_t> codes;
+            codes.reserve(rows.size());
+            for (auto&& row: rows) {
+                auto result = index.emplace(row.*member, values.size());
+                if (result.second)
+                    values.push_back(&result.first->first);
+                codes.push_back(result.first->second);
+            }
+
+            JSArray dict(values.size());
+            for_each_scoped(0, values.size(), [&](size_t i) {
+                dict.setElement(i, JSString(*values[i]));
+            });
+            JSObject column;
+            column.setProperty("values", dict);
+            column.setProperty("codes", JSTypedArray<uint32_t>(std::move(codes)));
+            return JSValue(column);
+        });
+        return *this;
+    }
+
+    JSObject operator()(const std::vector<T>& rows) const {
+        JSObject table;
+        table.setProperty("length", JSNumber(rows.size()));
+        for (auto&& column: columns_) {
+            JSScope scope;
+            table.setProperty(column.first, column.second(rows));
+        }
+        return table;
+    }
+
+private:
+    typedef std::function<JSValue(const std::vector<T>&)> Builder;
+    std::vector<std::pair<std::string, Builder>> columns_;
+};
+
+}
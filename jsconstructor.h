@@ -26,11 +26,32 @@
 #pragma once
 
 #include <functional>
+#include <iterator>
+#include <memory>
+#include <unordered_map>
 
 #include "jsfunction.h"
 
 namespace jsni {
 
+namespace internal {
+
+inline void install_dispose(JSObject proto, JSFunction dispose) {
+    struct Tag;
+    auto& func = environment_local<JSGlobalValue, Tag>();
+    if (!func) {
+        func = JSGlobalValue(JSFunction("p, f",
+            "var d = { value: f, writable: true, configurable: true };"
+            "Object.defineProperty(p, 'dispose', d);"
+            "if (typeof Symbol === 'function' && Symbol.dispose)"
+            "  Object.defineProperty(p, Symbol.dispose, d);"));
+    }
+    JSFunction installer = func;
+    installer(proto, dispose);
+}
+
+}
+
 template <class T>
 class JSNativeConstructor : public JSFunction {
 public:
@@ -48,7 +69,7 @@ public:
     JSNativeConstructor(const std::string& name,
                         std::function<void(JSNativeObject<T>&)> builder):
         JSNativeConstructor(name, JSNativeObject<T>(nullptr)) {
-        auto proto = JSNativeObject<T>(prototype_);
+        auto proto = JSNativeObject<T>(global_prototype());
         builder(proto);
     }
     JSNativeConstructor(std::function<void(JSNativeObject<T>&)> builder):
@@ -58,19 +79,99 @@ public:
             for (auto&& p: list) proto.setProperty(p.first, p.second);
         }) {}
 
+    // prototype of the class in current environment, or null
+    static JSValue classPrototype() {
+        if (!global_prototype())  return JSNull();
+        JSValue proto = global_prototype();
+        return proto;
+    }
+
     static JSNativeObject<T> wrap(T* native,
             std::function<void(T*)> deleter = std::default_delete<T>()) {
         JSNativeObject<T> jsobj(native, 0, deleter);
-        if (prototype_)
-            jsobj.setPrototype(prototype_);
+        if (global_prototype())
+            jsobj.setPrototype(global_prototype());
+        return jsobj;
+    }
+
+    // Install dispose() and [Symbol.dispose]() on the prototype of current
+    // environment, they delete the native of the receiver immediately.
+    static bool enableDispose() {
+        if (!global_prototype())  return false;
+        JSObject proto = global_prototype();
+        internal::install_dispose(proto, JSNativeFunction<dispose>("dispose"));
+        return true;
+    }
+
+    // JS function which returns JSNativeStats of the class
+    static JSFunction statsFunction() {
+        return JSNativeFunction<stats>("stats");
+    }
+
+    // Wrap the native, or return its wrapper if it is still alive, so a
+    // native object has one identity in JavaScript. Wrappers are held
+    // weakly and evicted from the map when they are garbage collected.
+    static JSNativeObject<T> wrapUnique(T* native,
+            std::function<void(T*)> deleter = std::default_delete<T>()) {
+        auto& wrappers = identity_map();
+        auto it = wrappers.find(native);
+        if (it != wrappers.end() && !it->second.expired()) {
+            // a disposed wrapper no longer holds the native
+            JSNativeObject<T> jsobj(it->second.lock());
+            if (jsobj.native() == native)  return jsobj;
+        }
+
+        JSNativeObject<T> jsobj = wrap(native, deleter);
+        auto map = &wrappers;
+        wrappers[native] = JSWeakValue(jsobj, [map, native]() {
+            auto it = map->find(native);
+            if (it != map->end() && it->second.expired())
+                map->erase(it);
+        });
         return jsobj;
     }
 
+    // Wrap each native of a range of T* or std::shared_ptr<T> in an array.
+    // Raw pointers are deleted by GC only if owned. Finalizers are plain
+    // functions, and the prototype is set for all wrappers in one call.
+    template <typename Iterator>
+    static JSArray wrapAll(Iterator begin, Iterator end, bool owned = true,
+                           size_t chunk = 1024);
+
 private:
     void setName(const std::string& name);
 
     static void thunk(JSNIEnv* env, const JSNICallbackInfo info);
-    static JSGlobalValue prototype_;
+
+    // disposing a disposed wrapper does nothing
+    static JSValue dispose(JSObject self, JSArray) {
+        if (!JSNativeObject<T>::check(self))
+            internal::illegal_invocation();
+        else
+            JSNativeObject<T>(self).dispose();
+        return JSUndefined();
+    }
+    static JSValue stats(JSObject, JSArray) {
+        auto stats = JSNativeStats<T>::snapshot();
+        return JSObject {
+            {"live", JSNumber(stats.live)},
+            {"bytes", JSNumber(stats.bytes)},
+            {"allocations", JSNumber(stats.allocations)},
+            {"finalizations", JSNumber(stats.finalizations)},
+            {"peak", JSNumber(stats.peak)}
+        };
+    }
+
+    // live wrappers of natives in current environment
+    typedef std::unordered_map<T*, JSWeakValue> IdentityMap;
+    static IdentityMap& identity_map() {
+        return internal::environment_local<IdentityMap, JSNativeConstructor>();
+    }
+
+    // prototype of current environment
+    static JSGlobalValue& global_prototype() {
+        return internal::environment_local<JSGlobalValue, T>();
+    }
 };
 
 }
@@ -78,60 +179,150 @@ private:
 
 //////////////////////////////////////////////////////////////////////////////
 
+#include <string.h>
+
 #include <cassert>
-#if __cpp_rtti || __GXX_RTTI
-#include <cxxabi.h>
+#if !defined(__GNUC__) && (__cpp_rtti || __GXX_RTTI)
 #include <typeinfo>
 #endif
 
 namespace jsni {
 
-template <class T>
-JSGlobalValue JSNativeConstructor<T>::prototype_ = nullptr;
-
 template <class T>
 JSNativeConstructor<T>::JSNativeConstructor(
         const std::string& name, JSNativeObject<T> prototype):
     JSFunction(thunk) {
     setName(name);
     setProperty("prototype", prototype);
-    prototype_ = JSGlobalValue(prototype);
+    global_prototype() = JSGlobalValue(prototype);
+}
+
+namespace internal {
+
+// Name of the type taken from the signature of a function template, which
+// the compiler has already demangled.
+template <typename T>
+const std::string& type_name() {
+#if defined(__GNUC__)
+    // "... type_name() [with T = Foo; ...]" or "... type_name() [T = Foo]"
+    static const std::string name = [](const char* signature) {
+        const char* begin = strstr(signature, "T = ");
+        if (!begin)  return std::string();
+        const char* end = begin += 4;
+        for (int depth = 0; *end; ++end) {
+            if (*end == '<' || *end == '(')  ++depth;
+            else if (*end == '>' || *end == ')')  --depth;
+            else if (!depth && (*end == ';' || *end == ']'))  break;
+        }
+        return std::string(begin, end);
+    }(__PRETTY_FUNCTION__);
+#elif __cpp_rtti || __GXX_RTTI
+    static const std::string name = typeid(T).name();
+#else
+    static const std::string name;
+#endif
+    return name;
+}
+
 }
 
 template <class T>
 void JSNativeConstructor<T>::setName(const std::string& name) {
-    if (!name.empty()) {
-        JSFunction::setName(name);
-    } else {
-#if __cpp_rtti || __GXX_RTTI
-        size_t len;
-        char *cname = abi::__cxa_demangle(typeid(T).name(), NULL, &len, NULL);
-        JSFunction::setName(std::string(cname, len));
-        free(cname);
+    const std::string& cname = name.empty() ? internal::type_name<T>() : name;
+    if (!cname.empty())
+        JSFunction::setName(cname);
+}
+
+namespace internal {
+
+template <class T, typename P>
+struct JSWrapTraits;
+
+template <class T>
+struct JSWrapTraits<T, T*> {
+    static JSNativeOwner<T>* owner(T* p, bool owned) {
+        if (!owned)  return nullptr;
+        return new JSNativeOwner<T>(p, std::default_delete<T>(), nullptr);
+    }
+    static T* native(T* p) {
+        return p;
+    }
+};
+
+template <class T>
+struct JSWrapTraits<T, std::shared_ptr<T>> {
+    static JSNativeOwner<T>* owner(const std::shared_ptr<T>& p, bool) {
+        return new JSNativeOwner<T>(p.get(), nullptr, p);
+    }
+    static T* native(const std::shared_ptr<T>& p) {
+        return p.get();
+    }
+};
+
+inline void set_prototypes(JSArray objects, JSObject proto) {
+    struct Tag;
+    auto& func = environment_local<JSGlobalValue, Tag>();
+    if (!func) {
+        func = JSGlobalValue(JSFunction("a, p",
+            "for (var i = 0; i < a.length; ++i) Object.setPrototypeOf(a[i], p);"));
+    }
+    JSFunction setter = func;
+    setter(objects, proto);
+}
+
+}
+
+template <class T>
+template <typename Iterator>
+JSArray JSNativeConstructor<T>::wrapAll(Iterator begin, Iterator end,
+                                        bool owned, size_t chunk) {
+    typedef internal::JSWrapTraits<T,
+        typename std::iterator_traits<Iterator>::value_type> Traits;
+    JSNIEnv* env = jsni::env();
+    size_t length = std::distance(begin, end);
+    JSArray array(length);
+    // same layout as JSNativeObject<T> without user fields
+    for_each_scoped(0, length, [&](size_t index) {
+        auto&& element = *begin++;
+        JSValueRef object = JSNINewObjectWithInternalField(env, 3);
+        auto owner = Traits::owner(element, owned);
+        JSNISetInternalField(env, object, 0,
+                             static_cast<internal::JSNativeOwnerBase*>(owner));
+        JSNISetInternalField(env, object, 1, Traits::native(element));
+#ifdef CHECK_NATIVE_TYPE
+        JSNISetInternalField(env, object, 2,
+                             reinterpret_cast<void*>(typeid(T).hash_code()));
 #endif
+        if (owner)  owner->attach(env, object);
+        JSNISetArrayElement(env, array, index, object);
+    }, chunk);
+    if (global_prototype()) {
+        JSObject proto = global_prototype();
+        internal::set_prototypes(array, proto);
     }
+    return array;
 }
 
 template <class T>
 void JSNativeConstructor<T>::thunk(JSNIEnv* env, const JSNICallbackInfo info) {
     assert(env == JSValue::env);
-    JSObject self = JSNIGetThisOfCallback(env, info);
-    JSObject prototype = self.prototype();
-
-    /* JSNI has no support of FunctionCallbackInfo::IsConstructCall()
-    if (prototype != prototype_) {
-        // this is a normal function call
-    }*/
-
-    // construct call
-    T* native = new(std::nothrow) T(self, info);
-    if (native == nullptr) {
-        // throw a JavaScript exception
-        return;
-    }
-    JSNativeObject<T> result(native, 0, std::default_delete<T>());
-    result.setPrototype(prototype);
-    JSNISetReturnValue(env, info, result);
+    internal::guard([&] {
+        JSObject self = JSNIGetThisOfCallback(env, info);
+        JSObject prototype = self.prototype();
+
+        /* JSNI has no support of FunctionCallbackInfo::IsConstructCall()
+        if (prototype != global_prototype()) {
+            // this is a normal function call
+        }*/
+
+        // construct call
+        T* native = new(std::nothrow) T(self, info);
+        if (native == nullptr)
+            return JSException::raise(JSException::Error, "Out of memory");
+        JSNativeObject<T> result(native, 0, std::default_delete<T>());
+        result.setPrototype(prototype);
+        JSNISetReturnValue(env, info, result);
+    });
 }
 
 }
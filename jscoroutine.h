@@ -0,0 +1,114 @@
+/*
+ * Copyright © 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#if defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+#include <exception>
+
+#include "jscallback.h"
+
+namespace jsni {
+
+// Fire-and-forget coroutine type. Native code can hop between the
+// JavaScript thread and the worker thread pool without blocking:
+//
+//   JSTask job(JSGlobalValue target) {
+//       co_await resume_on_worker();
+//       auto data = heavy();
+//       co_await resume_on_js();
+//       JSObject(target).setProperty("data", data);
+//   }
+class JSTask final {
+public:
+    struct promise_type {
+        JSTask get_return_object() noexcept { return JSTask(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+namespace internal {
+
+// the environment a worker thread has left, while it runs a coroutine
+inline JSNIEnv*& home_env() {
+    static thread_local JSNIEnv* home = nullptr;
+    return home;
+}
+
+template <bool js>
+class JSThreadAwaiter final {
+public:
+    // a JavaScript thread is its own home; a worker returns to the
+    // environment it was started from
+    JSThreadAwaiter() noexcept: env_(env() ? env() : home_env()) {}
+
+    bool await_ready() const noexcept {
+        return js ? env() != nullptr && env() == env_ : env() == nullptr;
+    }
+    void await_suspend(std::coroutine_handle<> handle) const noexcept {
+        // the coroutine may be resumed before AsyncThreadWork() returns,
+        // so nothing in the frame must be touched after this call.
+        if (js)
+            AsyncThreadWork(env_, handle.address(), nop, resume_js);
+        else
+            AsyncThreadWork(env_, handle.address(), resume_worker, nop);
+    }
+    void await_resume() const noexcept {}
+
+private:
+    static void nop(JSNIEnv*, void*) {}
+    static void resume_js(JSNIEnv* env, void* data) {
+        JSEnvironmentScope scope(env);
+        std::coroutine_handle<>::from_address(data).resume();
+    }
+    static void resume_worker(JSNIEnv* env, void* data) {
+        JSNIEnv* saved = home_env();
+        home_env() = env;
+        std::coroutine_handle<>::from_address(data).resume();
+        home_env() = saved;
+    }
+
+    JSNIEnv* env_;
+};
+
+}
+
+// continue the coroutine in the JavaScript thread
+inline internal::JSThreadAwaiter<true> resume_on_js() noexcept {
+    return {};
+}
+// continue the coroutine in a thread of the worker pool
+inline internal::JSThreadAwaiter<false> resume_on_worker() noexcept {
+    return {};
+}
+
+}
+
+#endif
@@ -25,6 +25,7 @@
  */
 #pragma once
 
+#include <stdexcept>
 #include <string>
 
 #include "jsvalue.h"
@@ -54,6 +55,79 @@ public:
     static void clear() {
         JSNIClearException(env());
     }
+
+#if __cpp_exceptions || __EXCEPTIONS
+    // Throw a JSError if JavaScript has thrown. Call it once at the end of
+    // a sequence of JSNI calls instead of has() after each of them.
+    static void check();
+#endif
 };
 
+#if __cpp_exceptions || __EXCEPTIONS
+// C++ exception which becomes a JavaScript error of given type when it
+// leaves a native callback. A pending error stands for an exception that
+// JavaScript has thrown, and it is left as is.
+class JSError : public std::runtime_error {
+public:
+    explicit JSError(const std::string& message,
+                     JSException::Type type = JSException::Error):
+        std::runtime_error(message), type_(type) {}
+
+    JSException::Type type() const {
+        return type_;
+    }
+    bool pending() const {
+        return pending_;
+    }
+
+private:
+    JSException::Type type_;
+    bool pending_ = false;
+    friend class JSException;
+};
+
+inline void JSException::check() {
+    if (!has())  return;
+    JSError error("JavaScript exception");
+    error.pending_ = true;
+    throw error;
+}
+#endif
+
+namespace internal {
+
+// Run the body of a native callback. C++ exceptions escaping from it are
+// raised as JavaScript exceptions. Without exceptions it is a plain call.
+template <typename F>
+inline void guard(F&& body) noexcept {
+#if __cpp_exceptions || __EXCEPTIONS
+    try {
+        body();
+    } catch (const JSError& e) {
+        if (!e.pending())  JSException::raise(e.type(), e.what());
+    } catch (const std::invalid_argument& e) {
+        JSException::raise(JSException::TypeError, e.what());
+    } catch (const std::out_of_range& e) {
+        JSException::raise(JSException::RangeError, e.what());
+    } catch (const std::range_error& e) {
+        JSException::raise(JSException::RangeError, e.what());
+    } catch (const std::length_error& e) {
+        JSException::raise(JSException::RangeError, e.what());
+    } catch (const std::exception& e) {
+        JSException::raise(JSException::Error, e.what());
+    } catch (...) {
+        JSException::raise(JSException::Error, "Unknown C++ exception");
+    }
+#else
+    body();
+#endif
+}
+
+// the receiver of a native method is not a native object of the class
+inline void illegal_invocation() {
+    JSException::raise(JSException::TypeError, "Illegal invocation");
+}
+
+}
+
 }
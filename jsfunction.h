@@ -25,13 +25,21 @@
  */
 #pragma once
 
+#include <algorithm>
 #include <cassert>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include "jsobject.h"
 #include "jsarray.h"
+#include "jsexception.h"
 
 namespace jsni {
 
+template <class T>
+struct JSClassMember;
+
 class JSFunction : public JSObject {
 public:
     JSFunction(JSValueRef jsval): JSObject(NoCheck(jsval)) {
@@ -53,9 +61,17 @@ public:
     }
 
     JSValue apply(JSValue self, JSArray args) const;
+    JSValue apply(JSValue self, size_t argc, JSValueRef* argv) const {
+        assert(*this);
+        return JSNICallFunction(env, jsval_, self, argc, argv);
+    }
     template <typename... Ts>
     JSValue call(JSValue self, Ts&&... args) const {
-        return apply(self, JSArray(sizeof...(Ts), std::forward<Ts>(args)...));
+        // arguments are passed in a stack buffer, not in a JSArray
+        JSValueRef argv[sizeof...(Ts) + 1] = {
+            value_ref(std::forward<Ts>(args))...
+        };
+        return apply(self, sizeof...(Ts), argv);
     }
     template <typename... Ts>
     JSValue operator()(Ts&&... args) const {
@@ -67,12 +83,102 @@ public:
     }
 
 protected:
-    typedef std::remove_pointer<JSNICallback>::type CallbackType;
     JSFunction(JSNICallback callback, bool save = false);
     operator JSNICallback() const;
 
+    // function of the native callback with the name, which is created once
+    // per environment and shared by later requests, so properties set on
+    // it or freezing it are seen through all of them
+    static JSFunction cached(JSNICallback callback,
+                             const std::string& name = "", bool save = false);
+
     void setName(const std::string& name);
     friend class JSPropertyDescriptor;
+
+private:
+    static JSValueRef value_ref(JSValue jsval) {
+        return jsval;
+    }
+    // native callbacks saved in functions of current environment
+    static std::vector<JSNICallback>& callbacks() {
+        return internal::environment_local<std::vector<JSNICallback>,
+                                           JSFunction>();
+    }
+};
+
+
+// A prepared method call. The receiver and the method are looked up once
+// and held in global values, so a call costs a single JSNICallFunction.
+// With revalidation, the method is looked up again before each call in
+// case it has been replaced on the object or its prototype chain, and the
+// function found is called directly. Calling
+// a handle without a method raises a TypeError.
+class JSMethodHandle {
+public:
+    JSMethodHandle() = default;
+    JSMethodHandle(JSObject receiver, const std::string& name,
+                   bool revalidate = false):
+        name_(name), receiver_(receiver), revalidate_(revalidate) {
+        resolve(receiver);
+    }
+
+    explicit operator bool() const {
+        return (bool)method_;
+    }
+
+    template <typename... Ts>
+    JSValue operator()(Ts&&... args) {
+        JSValueRef argv[sizeof...(Ts) + 1] = {
+            value_ref(std::forward<Ts>(args))...
+        };
+        return apply(sizeof...(Ts), argv);
+    }
+    JSValue apply(size_t argc, JSValueRef* argv) {
+        if (!receiver_)
+            return not_a_function();
+        JSObject receiver = receiver_;
+        if (revalidate_) {
+            // call what is there now, the cached method is not used
+            auto method = receiver.getProperty(name_);
+            if (!method.is(Function))
+                return not_a_function();
+            return method.as(Function).apply(receiver, argc, argv);
+        }
+        if (!method_)
+            return not_a_function();
+        JSFunction method = method_;
+        return method.apply(receiver, argc, argv);
+    }
+
+    // look up the method again
+    bool resolve() {
+        return resolve(receiver_);
+    }
+
+private:
+    bool resolve(JSObject receiver) {
+        auto method = receiver.getProperty(name_);
+        if (!method.is(Function)) {
+            // never fall back to a method which is gone
+            method_ = JSGlobalValue();
+            return false;
+        }
+        method_ = JSGlobalValue(method);
+        return true;
+    }
+    JSValue not_a_function() const {
+        JSException::raise(JSException::TypeError,
+                           name_ + " is not a function");
+        return JSUndefined();
+    }
+    static JSValueRef value_ref(JSValue jsval) {
+        return jsval;
+    }
+
+    std::string name_;
+    JSGlobalValue receiver_;
+    JSGlobalValue method_;
+    bool revalidate_ = false;
 };
 
 
@@ -82,14 +188,14 @@ using JSFunctionType = JSValue (*)(JSObject, JSArray);
 template<JSFunctionType function>
 class JSNativeFunction: public JSFunction {
 public:
-    JSNativeFunction(): JSFunction(thunk){}
+    JSNativeFunction(): JSFunction(cached(thunk)) {}
 
-    JSNativeFunction(const std::string& name): JSNativeFunction() {
-        setName(name);
-    }
+    JSNativeFunction(const std::string& name): JSFunction(cached(thunk, name)) {}
 
 private:
     static void thunk(JSNIEnv* env, const JSNICallbackInfo info);
+    template <class>
+    friend struct JSClassMember;
 };
 
 
@@ -99,15 +205,14 @@ private:
 template <class T, JSMethodType<T> method>
 class JSNativeMethod : public JSFunction {
 public:
-    JSNativeMethod(): JSFunction(thunk){}
+    JSNativeMethod(): JSFunction(cached(thunk)) {}
 
-    JSNativeMethod(const std::string& name): JSNativeMethod() {
-        setName(name);
-    }
+    JSNativeMethod(const std::string& name): JSFunction(cached(thunk, name)) {}
 
 private:
     static void thunk(JSNIEnv* env, const JSNICallbackInfo info);
     friend class JSNativeObject<T>;
+    friend struct JSClassMember<T>;
 };
 
 
@@ -117,11 +222,12 @@ private:
 template <class T, JSGetterType<T> getter>
 class JSNativeGetter : public JSFunction {
 public:
-    JSNativeGetter(): JSFunction(thunk, true){}
+    JSNativeGetter(): JSFunction(cached(thunk, "", true)) {}
 
 private:
     static void thunk(JSNIEnv* env, const JSNICallbackInfo info);
     friend class JSNativeObject<T>;
+    friend struct JSClassMember<T>;
 };
 
 //template <class T>
@@ -130,11 +236,12 @@ private:
 template <class T, JSSetterType<T> setter>
 class JSNativeSetter : public JSFunction {
 public:
-    JSNativeSetter(): JSFunction(thunk, true) {}
+    JSNativeSetter(): JSFunction(cached(thunk, "", true)) {}
 
 private:
     static void thunk(JSNIEnv* env, const JSNICallbackInfo info);
     friend class JSNativeObject<T>;
+    friend struct JSClassMember<T>;
 };
 
 //template <class T>
@@ -143,11 +250,12 @@ private:
 template <class T, JSAccessorType<T> accessor>
 class JSNativeAccessor : public JSFunction {
 public:
-    JSNativeAccessor(): JSFunction(thunk, true){}
+    JSNativeAccessor(): JSFunction(cached(thunk, "", true)) {}
 
 private:
     static void thunk(JSNIEnv* env, const JSNICallbackInfo info);
     friend class JSNativeObject<T>;
+    friend struct JSClassMember<T>;
 };
 
 // FYI: http://stackoverflow.com/questions/15148749/pointer-to-class-member-as-a-template-parameter
@@ -185,21 +293,60 @@ inline JSValue JSFunction::apply(JSValue self, JSArray args) const {
     return JSNICallFunction(env, jsfunc, self, 1, &arg);*/
 }
 
+// The callback is saved in the registry of the environment, and a hidden
+// number property of the function holds its index, not its address.
 inline JSFunction::JSFunction(JSNICallback callback, bool save):
     JSFunction(JSNINewFunction(env, callback)) {
     if (save) {
-        auto jsobj = JSNativeObject<CallbackType>(callback, 0, nullptr);
-        defineProperty("_jsni", JSPropertyDescriptor(jsobj, false));
+        auto& registry = callbacks();
+        auto it = std::find(registry.begin(), registry.end(), callback);
+        size_t index = it - registry.begin();
+        if (it == registry.end())  registry.push_back(callback);
+        JSNIDataPropertyDescriptor desc {
+            JSNINewNumber(env, index),
+            static_cast<JSNIPropertyAttributes>(
+                JSNIReadOnly | JSNIDontEnum | JSNIDontDelete)
+        };
+        JSNIDefineProperty(env, jsval_, "_jsni", {&desc, nullptr});
     }
 }
 
-inline JSFunction::operator JSNICallback() const {
-    if (*this) {
-        auto jsni = getProperty("_jsni");
-        if (jsni.is(Object))
-            return JSNativeObject<CallbackType>(jsni).native();
+namespace internal {
+
+struct JSCallbackKeyHash {
+    size_t operator()(
+            const std::pair<JSNICallback, std::string>& key) const {
+        return std::hash<void*>()(reinterpret_cast<void*>(key.first)) ^
+               std::hash<std::string>()(key.second);
+    }
+};
+
+}
+
+inline JSFunction JSFunction::cached(JSNICallback callback,
+                                     const std::string& name, bool save) {
+    typedef std::unordered_map<std::pair<JSNICallback, std::string>,
+                               JSGlobalValue,
+                               internal::JSCallbackKeyHash> Cache;
+    auto& cache = internal::environment_local<Cache, JSFunction>();
+    auto& func = cache[std::make_pair(callback, name)];
+    if (!func) {
+        JSFunction jsfunc(callback, save);
+        if (!name.empty())  jsfunc.setName(name);
+        func = JSGlobalValue(jsfunc);
     }
-    return nullptr;
+    JSFunction jsfunc = func;
+    return jsfunc;
+}
+
+inline JSFunction::operator JSNICallback() const {
+    if (!*this)  return nullptr;
+    JSValueRef jsni = JSNIGetProperty(env, jsval_, "_jsni");
+    if (!JSNIIsNumber(env, jsni))  return nullptr;
+    double index = JSNIToCDouble(env, jsni);
+    auto& registry = callbacks();
+    if (!(index >= 0 && index < registry.size()))  return nullptr;
+    return registry[static_cast<size_t>(index)];
 }
 
 inline void JSFunction::setName(const std::string& name) {
@@ -211,67 +358,70 @@ inline void JSFunction::setName(const std::string& name) {
 template <JSFunctionType function>
 void JSNativeFunction<function>::thunk(JSNIEnv* env, const JSNICallbackInfo info) {
     assert(env == JSValue::env);
-    JSObject self = JSNIGetThisOfCallback(env, info);
-    JSValue result = (*function)(self, info);
-    JSNISetReturnValue(env, info, result);
+    internal::guard([&] {
+        JSObject self = JSNIGetThisOfCallback(env, info);
+        JSValue result = (*function)(self, info);
+        JSNISetReturnValue(env, info, result);
+    });
 }
 
 template <class T, JSMethodType<T> method>
 void JSNativeMethod<T, method>::thunk(JSNIEnv* env, const JSNICallbackInfo info) {
     assert(env == JSValue::env);
-    JSNativeObject<T> self(JSNIGetThisOfCallback(env, info));
-    T* native = self.native();
-    if (native) {
+    internal::guard([&] {
+        JSNativeObject<T> self(JSNIGetThisOfCallback(env, info));
+        T* native = self.native();
+        if (!native)
+            return internal::illegal_invocation();
         JSValue result = (native->*method)(self, info);
         JSNISetReturnValue(env, info, result);
-    } else {
-        //TODO: throw an exception
-    }
+    });
 }
 
 template <class T, JSGetterType<T> getter>
 void JSNativeGetter<T, getter>::thunk(JSNIEnv* env, const JSNICallbackInfo info) {
     assert(env == JSValue::env);
-    JSNativeObject<T> self(JSNIGetThisOfCallback(env, info));
-    T* native = self.native();
-    if (native) {
+    internal::guard([&] {
+        JSNativeObject<T> self(JSNIGetThisOfCallback(env, info));
+        T* native = self.native();
+        if (!native)
+            return internal::illegal_invocation();
         JSValue result = (native->*getter)(self);
         JSNISetReturnValue(env, info, result);
-    } else {
-        //TODO: throw an exception
-    }
+    });
 }
 
 template <class T, JSSetterType<T> setter>
 void JSNativeSetter<T, setter>::thunk(JSNIEnv* env, const JSNICallbackInfo info) {
     assert(env == JSValue::env);
-    JSNativeObject<T> self(JSNIGetThisOfCallback(env, info));
-    T* native = self.native();
-    if (native) {
+    internal::guard([&] {
+        JSNativeObject<T> self(JSNIGetThisOfCallback(env, info));
+        T* native = self.native();
+        if (!native)
+            return internal::illegal_invocation();
         (native->*setter)(self, JSNIGetArgOfCallback(env, info, 0));
-    } else {
-        //TODO: throw an exception
-    }
+    });
 }
 
 template <class T, JSAccessorType<T> accessor>
 void JSNativeAccessor<T, accessor>::thunk(JSNIEnv* env,
                                           const JSNICallbackInfo info) {
     assert(env == JSValue::env);
-    JSNativeObject<T> self(JSNIGetThisOfCallback(env, info));
-    T* native = self.native();
-    if (!native) {
-        return;  //TODO: throw an exception
-    }
-
-    int argc = JSNIGetArgsLengthOfCallback(env, info);
-    if (argc == 0) {
-        JSValue result = (native->*accessor)(self, JSValue());
-        JSNISetReturnValue(env, info, result);
-    } else {
-        assert(argc == 1);
-        (native->*accessor)(self, JSNIGetArgOfCallback(env, info, 0));
-    }
+    internal::guard([&] {
+        JSNativeObject<T> self(JSNIGetThisOfCallback(env, info));
+        T* native = self.native();
+        if (!native)
+            return internal::illegal_invocation();
+
+        int argc = JSNIGetArgsLengthOfCallback(env, info);
+        if (argc == 0) {
+            JSValue result = (native->*accessor)(self, JSValue());
+            JSNISetReturnValue(env, info, result);
+        } else {
+            assert(argc == 1);
+            (native->*accessor)(self, JSNIGetArgOfCallback(env, info, 0));
+        }
+    });
 }
 
 }
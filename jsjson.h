@@ -0,0 +1,473 @@
+/*
+ * Copyright © 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <cmath>
+#include <string>
+#include <type_traits>
+#include <unordered_set>
+#include <vector>
+#if __cplusplus >= 201703L
+#include <charconv>
+#include <optional>
+#endif
+
+#include "apply.h"
+#include "jsvalue.h"
+#include "jsarray.h"
+#include "jsfunction.h"
+#include "jsreflect.h"
+
+namespace jsni {
+
+// Serializer of native values to JSON text:
+//   static void write(JSONWriter& writer, const T& value);
+//   static size_t count(const T& value);  // number of JSON values
+template <typename T, typename = void>
+struct JSONTraits;
+
+class JSONWriter {
+public:
+    const std::string& str() const {
+        return buffer_;
+    }
+    void reserve(size_t size) {
+        buffer_.reserve(size);
+    }
+
+    void null() {
+        separate();
+        buffer_ += "null";
+    }
+    void boolean(bool value) {
+        separate();
+        buffer_ += value ? "true" : "false";
+    }
+    void number(double value) {
+        separate();
+        if (!std::isfinite(value)) {
+            buffer_ += "null";
+            exact_ = false;
+            return;
+        }
+        char buf[32];
+#if __cpp_lib_to_chars >= 201611L
+        auto end = std::to_chars(buf, buf + sizeof(buf), value).ptr;
+        buffer_.append(buf, end - buf);
+#else
+        int len = snprintf(buf, sizeof(buf), "%.17g", value);
+        // the decimal point of the C locale is the only one JSON accepts
+        for (int i = 0; i < len; ++i)
+            if (buf[i] == ',')  buf[i] = '.';
+        buffer_.append(buf, len);
+#endif
+    }
+    void string(const char* str, size_t len) {
+        separate();
+        escape(str, len);
+    }
+    void string(const std::string& str) {
+        string(str.data(), str.length());
+    }
+
+    void startObject() {
+        separate();
+        buffer_ += '{';
+        first_ = true;
+    }
+    void key(const char* str, size_t len) {
+        separate();
+        escape(str, len);
+        buffer_ += ':';
+        first_ = true;
+    }
+    void key(const std::string& str) {
+        key(str.data(), str.length());
+    }
+    void endObject() {
+        buffer_ += '}';
+        first_ = false;
+    }
+    void startArray() {
+        separate();
+        buffer_ += '[';
+        first_ = true;
+    }
+    void endArray() {
+        buffer_ += ']';
+        first_ = false;
+    }
+
+    template <typename T>
+    void write(const T& value) {
+        JSONTraits<T>::write(*this, value);
+    }
+
+    // false once a value has been written which JSON cannot represent
+    bool exact() const {
+        return exact_;
+    }
+
+private:
+    void separate() {
+        if (!first_)  buffer_ += ',';
+        first_ = false;
+    }
+    void escape(const char* str, size_t len) {
+        static const char hex[] = "0123456789abcdef";
+        buffer_ += '"';
+        for (size_t i = 0; i < len; ++i) {
+            unsigned char c = str[i];
+            switch (c) {
+                case '"':  buffer_ += "\\\""; break;
+                case '\\': buffer_ += "\\\\"; break;
+                case '\b': buffer_ += "\\b"; break;
+                case '\f': buffer_ += "\\f"; break;
+                case '\n': buffer_ += "\\n"; break;
+                case '\r': buffer_ += "\\r"; break;
+                case '\t': buffer_ += "\\t"; break;
+                default:
+                    if (c < 0x20) {
+                        buffer_ += "\\u00";
+                        buffer_ += hex[c >> 4];
+                        buffer_ += hex[c & 0xf];
+                    } else {
+                        buffer_ += c;
+                    }
+            }
+        }
+        buffer_ += '"';
+    }
+
+    std::string buffer_;
+    bool first_ = true;
+    bool exact_ = true;
+};
+
+template <>
+struct JSONTraits<bool> {
+    static void write(JSONWriter& writer, bool value) {
+        writer.boolean(value);
+    }
+    static size_t count(bool) {
+        return 1;
+    }
+};
+
+template <typename T>
+struct JSONTraits<T, typename std::enable_if<
+        std::is_arithmetic<T>::value>::type> {
+    static void write(JSONWriter& writer, T value) {
+        writer.number(static_cast<double>(value));
+    }
+    static size_t count(T) {
+        return 1;
+    }
+};
+
+template <>
+struct JSONTraits<std::string> {
+    static void write(JSONWriter& writer, const std::string& value) {
+        writer.string(value);
+    }
+    static size_t count(const std::string&) {
+        return 1;
+    }
+};
+
+template <typename T>
+struct JSONTraits<std::vector<T>> {
+    static void write(JSONWriter& writer, const std::vector<T>& value) {
+        writer.startArray();
+        for (auto&& element: value)
+            JSONTraits<T>::write(writer, element);
+        writer.endArray();
+    }
+    static size_t count(const std::vector<T>& value) {
+        size_t n = 1;
+        for (auto&& element: value)
+            n += JSONTraits<T>::count(element);
+        return n;
+    }
+};
+
+// map with string keys
+template <typename T>
+struct JSONTraits<T, typename std::enable_if<
+        std::is_same<typename T::key_type, std::string>::value &&
+        !std::is_same<typename T::key_type,
+                      typename T::value_type>::value>::type> {
+    typedef typename T::mapped_type M;
+    static void write(JSONWriter& writer, const T& value) {
+        writer.startObject();
+        for (auto&& p: value) {
+            writer.key(p.first);
+            JSONTraits<M>::write(writer, p.second);
+        }
+        writer.endObject();
+    }
+    static size_t count(const T& value) {
+        size_t n = 1;
+        for (auto&& p: value)
+            n += JSONTraits<M>::count(p.second);
+        return n;
+    }
+};
+
+#if __cplusplus >= 201703L
+template <typename T>
+struct JSONTraits<std::optional<T>> {
+    static void write(JSONWriter& writer, const std::optional<T>& value) {
+        if (value)
+            JSONTraits<T>::write(writer, *value);
+        else
+            writer.null();
+    }
+    static size_t count(const std::optional<T>& value) {
+        return value ? JSONTraits<T>::count(*value) : 1;
+    }
+};
+#endif
+
+// reflected struct
+template <class T>
+struct JSONTraits<T, typename std::enable_if<
+        internal::is_reflected<T>::value>::type> {
+    static void write(JSONWriter& writer, const T& value) {
+        writer.startObject();
+        jsni::apply([&](const auto&... fields) {
+            int unused[] = { 0, (write_field(writer, value, fields), 0)... };
+            (void)unused;
+        }, JSReflection<T>::fields());
+        writer.endObject();
+    }
+    static size_t count(const T& value) {
+        return jsni::apply([&](const auto&... fields) {
+            size_t n = 1;
+            int unused[] = { 0, (n += count_field(value, fields), 0)... };
+            (void)unused;
+            return n;
+        }, JSReflection<T>::fields());
+    }
+
+private:
+    template <typename M>
+    static void write_field(JSONWriter& writer, const T& value,
+                            const JSField<T, M>& field) {
+        writer.key(field.name, strlen(field.name));
+        JSONTraits<M>::write(writer, value.*(field.member));
+    }
+    template <typename M>
+    static size_t count_field(const T& value, const JSField<T, M>& field) {
+        return JSONTraits<M>::count(value.*(field.member));
+    }
+};
+
+// SAX handler which builds a JS value directly from parse events, without
+// an intermediate DOM. The interface follows RapidJSON's Handler concept.
+// Children of each container are created in a local scope of their own,
+// which is recycled every 'chunk' elements. Keys are interned.
+class JSValueBuilder final {
+public:
+    explicit JSValueBuilder(size_t chunk = 1024):
+        chunk_(chunk), result_(JSNINewUndefined(env())) {}
+    ~JSValueBuilder() {
+        for (size_t i = 0; i < stack_.size(); ++i)
+            JSNIPopLocalScope(env());
+    }
+    JSValueBuilder(const JSValueBuilder&) = delete;
+    JSValueBuilder& operator =(const JSValueBuilder&) = delete;
+
+    bool Null() {
+        return add(JSNINewNull(env()));
+    }
+    bool Bool(bool value) {
+        return add(JSNINewBoolean(env(), value));
+    }
+    bool Int(int value) {
+        return add(JSNINewNumber(env(), value));
+    }
+    bool Uint(unsigned value) {
+        return add(JSNINewNumber(env(), value));
+    }
+    bool Int64(int64_t value) {
+        return add(JSNINewNumber(env(), static_cast<double>(value)));
+    }
+    bool Uint64(uint64_t value) {
+        return add(JSNINewNumber(env(), static_cast<double>(value)));
+    }
+    bool Double(double value) {
+        return add(JSNINewNumber(env(), value));
+    }
+    bool RawNumber(const char* str, unsigned len, bool) {
+#if __cpp_lib_to_chars >= 201611L
+        double value = 0;
+        std::from_chars(str, str + len, value);
+        return Double(value);
+#else
+        return Double(strtod(std::string(str, len).c_str(), nullptr));
+#endif
+    }
+    bool String(const char* str, unsigned len, bool) {
+        return add(JSNINewStringFromUtf8(env(), str, len));
+    }
+
+    bool StartObject() {
+        return start(JSNINewObject(env()), false);
+    }
+    bool Key(const char* str, unsigned len, bool) {
+        if (stack_.empty() || stack_.back().array || stack_.back().key)
+            return false;
+        // look up through a reused buffer, a known key allocates nothing
+        key_.assign(str, len);
+        auto it = keys_.find(key_);
+        if (it == keys_.end())
+            it = keys_.insert(key_).first;
+        stack_.back().key = it->c_str();
+        return true;
+    }
+    bool EndObject(unsigned = 0) {
+        return end(false);
+    }
+    bool StartArray() {
+        return start(JSNINewArray(env(), 0), true);
+    }
+    bool EndArray(unsigned = 0) {
+        return end(true);
+    }
+
+    // true once the root value is complete
+    bool done() const {
+        return done_;
+    }
+    JSValue result() const {
+        return result_;
+    }
+
+private:
+    struct Frame {
+        JSValueRef container;
+        bool array;
+        size_t count;
+        const char* key;
+    };
+
+    bool add(JSValueRef value) {
+        if (stack_.empty()) {
+            if (done_)  return false;
+            result_ = value;
+            done_ = true;
+            return true;
+        }
+        Frame& frame = stack_.back();
+        if (frame.array) {
+            JSNISetArrayElement(env(), frame.container, frame.count, value);
+        } else {
+            if (!frame.key)  return false;
+            JSNISetProperty(env(), frame.container, frame.key, value);
+            frame.key = nullptr;
+        }
+        if (++frame.count % chunk_ == 0) {
+            JSNIPopLocalScope(env());
+            JSNIPushLocalScope(env());
+        }
+        return true;
+    }
+    bool start(JSValueRef container, bool array) {
+        if (done_ && stack_.empty())  return false;
+        if (!stack_.empty() && !stack_.back().array && !stack_.back().key)
+            return false;
+        stack_.push_back(Frame{container, array, 0, nullptr});
+        JSNIPushLocalScope(env());
+        return true;
+    }
+    bool end(bool array) {
+        if (stack_.empty() || stack_.back().array != array ||
+            stack_.back().key)
+            return false;
+        JSNIPopLocalScope(env());
+        JSValueRef container = stack_.back().container;
+        stack_.pop_back();
+        return add(container);
+    }
+
+    size_t chunk_;
+    std::vector<Frame> stack_;
+    std::unordered_set<std::string> keys_;
+    std::string key_;
+    JSValueRef result_;
+    bool done_ = false;
+};
+
+// Native JSON fast path. For large values, writing JSON text natively and
+// calling JSON.parse() once is faster than creating the value property by
+// property through JSNI.
+class JSON final {
+public:
+    template <typename T>
+    static std::string stringify(const T& value) {
+        JSONWriter writer;
+        writer.write(value);
+        return writer.str();
+    }
+
+    // JSON.parse() is looked up once per environment
+    static JSValue parse(const std::string& text) {
+        auto& parser = internal::environment_local<JSGlobalValue, JSON>();
+        if (!parser)
+            parser = JSGlobalValue(JSFunction("", "return JSON.parse;")());
+        JSFunction func = parser;
+        return func(text);
+    }
+
+    // convert through JSON text if the value has at least crossover()
+    // JSON values, otherwise convert with JSConvert directly. Values with
+    // NaN or infinities always go through JSConvert, which keeps them.
+    template <typename T>
+    static JSValue convert(const T& value) {
+        if (JSONTraits<T>::count(value) < crossover())
+            return JSConvert<T>::to(value);
+        JSONWriter writer;
+        writer.write(value);
+        if (!writer.exact())
+            return JSConvert<T>::to(value);
+        return parse(writer.str());
+    }
+
+    // the crossover depends on the engine, it can be tuned by application
+    static std::atomic<size_t>& crossover() {
+        static std::atomic<size_t> threshold(1000);
+        return threshold;
+    }
+};
+
+}
@@ -30,16 +30,27 @@
 #include "jsobject.h"
 #include "jsarray.h"
 #include "jstypedarray.h"
+#include "jstemplate.h"
+#include "jsreflect.h"
+#include "jscolumnar.h"
+#include "jsjson.h"
+#include "jsbinary.h"
 #include "jsfunction.h"
+#include "jsoverload.h"
 #include "jscallback.h"
+#include "jscoroutine.h"
+#include "jsasync.h"
 #include "jsconstructor.h"
+#include "jsclass.h"
 #include "jsexception.h"
+#include "jscache.h"
 
 #include "jsobject.hpp"
 #include "jsprimitive.hpp"
 
 namespace jsni{
 
+// bind the environment to current thread
 inline JSObject initialize(JSNIEnv* env, JSValueRef exports = nullptr) {
     internal::JSGlobalEnvironment::env = env;
     if (JSNIIsObject(env, exports))
@@ -48,7 +59,8 @@ inline JSObject initialize(JSNIEnv* env, JSValueRef exports = nullptr) {
 }
 
 inline bool JSValue::operator ==(const JSValue& that) const {
-    return JSObject::constructor()["is"].as(Function)(*this, that).as(Boolean);
+    auto is = JSObject::staticMethod(internal::ObjectIs);
+    return is(*this, that).as(Boolean);
 }
 
 }
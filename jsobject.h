@@ -25,13 +25,17 @@
  */
 #pragma once
 
+#include <stdint.h>
+
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <functional>
 #include <initializer_list>
 #include <memory>
-#include <unordered_set>
+#include <unordered_map>
 #include <string>
+#include <type_traits>
 #include <utility>
 
 #if (__cpp_rtti || defined(__GXX_RTTI)) && !defined(NDEBUG)
@@ -46,6 +50,36 @@ namespace jsni {
 class JSPropertyDescriptor;
 class JSFunction;
 
+namespace internal {
+
+// static methods of Object, sorted by name except the last one which is
+// not dispatched by JSObject::callMethod()
+enum JSObjectMethod {
+    ObjectAssign = 0,
+    ObjectCreate,
+    ObjectDefineProperties,
+    ObjectDefineProperty,
+    ObjectEntries,
+    ObjectFreeze,
+    ObjectGetOwnPropertyDescriptor,
+    ObjectGetOwnPropertyDescriptors,
+    ObjectGetOwnPropertyNames,
+    ObjectGetOwnPropertySymbols,
+    ObjectGetPrototypeOf,
+    ObjectIsExtensible,
+    ObjectIsFrozen,
+    ObjectIsSealed,
+    ObjectKeys,
+    ObjectPreventExtensions,
+    ObjectSeal,
+    ObjectSetPrototypeOf,
+    ObjectValues,
+    ObjectIs,
+    ObjectMethodCount
+};
+
+}
+
 class JSObject : public JSValue {
 public:
     JSObject(JSValueRef jsval);
@@ -79,9 +113,7 @@ public:
     JSObject prototype() const {
         return JSObject(NoCheck(JSNIGetPrototype(env, jsval_)));
     }
-    void setPrototype(JSObject proto) {
-        callMethod("setPrototypeOf", proto);
-    }
+    void setPrototype(JSObject proto);
     bool isPrototypeOf(JSObject object) const {
         auto self = const_cast<JSObject*>(this);
         return self->callMethod("isPrototypeOf", object).as(Boolean);
@@ -92,6 +124,26 @@ public:
         return self->callMethod("toString").as(String);
     }
 
+    // static methods of Object applied on this object, the functions are
+    // looked up once per environment
+    JSArray keys() const;
+    JSArray values() const;
+    JSArray entries() const;
+    JSArray getOwnPropertyNames() const;
+    JSArray getOwnPropertySymbols() const;
+    JSValue getOwnPropertyDescriptor(const std::string& name) const;
+    JSObject getOwnPropertyDescriptors() const;
+    bool defineProperties(JSObject descriptors);
+    JSObject freeze();
+    JSObject seal();
+    JSObject preventExtensions();
+    bool isFrozen() const;
+    bool isSealed() const;
+    bool isExtensible() const;
+    template <typename... Ts>
+    JSObject assign(Ts&&... sources);
+    static JSObject create(JSValue prototype);
+
     // TODO: support Symbol
     template <typename T>
     T getProperty(const std::string& name, JSTypeID<T> = JSTypeID<T>()) const {
@@ -161,8 +213,12 @@ protected:
     constexpr JSObject(NoCheck jsval): JSValue(jsval) {}
 
     static JSObject constructor() {
-        return JSObject().getProperty("constructor").as(Object);
+        auto& ctor = internal::environment_local<JSGlobalValue, JSObject>();
+        if (!ctor)
+            ctor = JSGlobalValue(JSObject().getProperty("constructor"));
+        return ctor;
     }
+    static JSFunction staticMethod(internal::JSObjectMethod method);
     friend class JSValue;
 };
 
@@ -206,14 +262,14 @@ public:
     template <typename T>
     typename std::enable_if<!std::is_pointer<T>::value, T>::type
     get(int index) const {
-        assert(index >= count());
+        assert(index < count());
         auto ptr = JSNIGetInternalField(env, jsval_, index);
         return static_cast<T>(reinterpret_cast<uintptr_t>(ptr));
     }
     template <typename T>
     typename std::enable_if<std::is_pointer<T>::value, T>::type
     get(int index) const {
-        assert(index >= count());
+        assert(index < count());
         auto ptr = JSNIGetInternalField(env, jsval_, index);
         return reinterpret_cast<T>(ptr);
     }
@@ -221,20 +277,20 @@ public:
     template <typename T>
     typename std::enable_if<!std::is_pointer<T>::value>::type
     set(int index, T val) {
-        assert(index >= count());
+        assert(index < count());
         auto ptr = static_cast<uintptr_t>(val);
         JSNISetInternalField(env, jsval_, index, reinterpret_cast<void*>(ptr));
     }
     template <typename T>
     typename std::enable_if<is_nonconst_pointer<T>::value>::type
     set(int index, T ptr) {
-        assert(index >= count());
+        assert(index < count());
         JSNISetInternalField(env, jsval_, index, reinterpret_cast<void*>(ptr));
     }
     template <typename T>
     typename std::enable_if<is_const_pointer<T>::value>::type
     set(int index, T ptr) {
-        assert(index >= count());
+        assert(index < count());
         typedef typename std::remove_pointer<T>::type U;
         auto p = const_cast<typename std::remove_const<U>::type*>(ptr);
         JSNISetInternalField(env, jsval_, index, reinterpret_cast<void*>(p));
@@ -254,6 +310,142 @@ private:
 };
 
 
+// Size in bytes of a native object for accounting. Specialize it for a
+// class which owns more memory. The size must not change while the object
+// is owned by a JS wrapper.
+template <class T>
+struct JSNativeSize {
+    static size_t of(const T*) {
+        return sizeof(typename std::conditional<
+                      std::is_object<T>::value, T, char>::type);
+    }
+};
+
+// Per class counters of native objects owned by JS wrappers. Rates can be
+// derived from the totals of two snapshots.
+template <class T>
+class JSNativeStats final {
+public:
+    struct Snapshot {
+        size_t live;
+        size_t bytes;
+        size_t allocations;
+        size_t finalizations;
+        size_t peak;    // highest bytes
+    };
+    typedef std::function<void(const Snapshot&)> Alert;
+
+    static Snapshot snapshot() {
+        const auto& c = counters();
+        return Snapshot {
+            c.live.load(std::memory_order_relaxed),
+            c.bytes.load(std::memory_order_relaxed),
+            c.allocations.load(std::memory_order_relaxed),
+            c.finalizations.load(std::memory_order_relaxed),
+            c.peak.load(std::memory_order_relaxed)
+        };
+    }
+
+    // Alert once when live bytes rise above the limit, and again after
+    // they have fallen below it. Set it before objects are created.
+    static void setHighWaterMark(size_t limit, Alert alert) {
+        auto& c = counters();
+        c.limit = alert ? limit : SIZE_MAX;
+        c.alert = std::move(alert);
+        c.armed = true;
+    }
+
+    static void allocated(const T* native) {
+        auto& c = counters();
+        size_t size = JSNativeSize<T>::of(native);
+        c.live.fetch_add(1, std::memory_order_relaxed);
+        c.allocations.fetch_add(1, std::memory_order_relaxed);
+        size_t bytes =
+            c.bytes.fetch_add(size, std::memory_order_relaxed) + size;
+        size_t peak = c.peak.load(std::memory_order_relaxed);
+        while (bytes > peak && !c.peak.compare_exchange_weak(
+                    peak, bytes, std::memory_order_relaxed)) {}
+        if (bytes > c.limit && c.armed.exchange(false))
+            c.alert(snapshot());
+    }
+    static void finalized(const T* native) {
+        auto& c = counters();
+        size_t size = JSNativeSize<T>::of(native);
+        c.live.fetch_sub(1, std::memory_order_relaxed);
+        c.finalizations.fetch_add(1, std::memory_order_relaxed);
+        size_t bytes =
+            c.bytes.fetch_sub(size, std::memory_order_relaxed) - size;
+        if (bytes <= c.limit)
+            c.armed.store(true, std::memory_order_relaxed);
+    }
+
+private:
+    struct Counters {
+        std::atomic<size_t> live{0};
+        std::atomic<size_t> bytes{0};
+        std::atomic<size_t> allocations{0};
+        std::atomic<size_t> finalizations{0};
+        std::atomic<size_t> peak{0};
+        std::atomic<bool> armed{true};
+        size_t limit = SIZE_MAX;
+        Alert alert;
+    };
+    static Counters& counters() {
+        static Counters c;
+        return c;
+    }
+};
+
+namespace internal {
+
+// Owner of the native object of a wrapper, shared by the GC callback and
+// dispose(), so the native is deleted exactly once. The owner is stored
+// type-erased, a wrapper read as its base class still releases the native
+// with the deleter and stats of its own class.
+struct JSNativeOwnerBase {
+    virtual ~JSNativeOwnerBase() = default;
+    virtual void release() = 0;
+
+    static void collect(JSNIEnv*, void* data) {
+        auto owner = static_cast<JSNativeOwnerBase*>(data);
+        owner->release();
+        delete owner;
+    }
+};
+
+template <class T>
+struct JSNativeOwner final : JSNativeOwnerBase {
+    JSNativeOwner(T* native, std::function<void(T*)> deleter,
+                  std::shared_ptr<T> shared):
+        native(native), deleter(std::move(deleter)),
+        shared(std::move(shared)) {}
+
+    T* native;
+    std::function<void(T*)> deleter;
+    std::shared_ptr<T> shared;
+
+    void release() override {
+        if (!native)  return;
+        T* p = native;
+        native = nullptr;
+        JSNativeStats<T>::finalized(p);
+        if (deleter)  deleter(p);
+        shared.reset();
+    }
+
+    // register the owner as the GC callback of the wrapper
+    void attach(JSNIEnv* env, JSValueRef jsval) {
+        JSNativeStats<T>::allocated(native);
+        JSGlobalValueRef jsgval = JSNINewGlobalValue(env, jsval);
+        JSNISetGCCallback(env, jsgval,
+                          static_cast<JSNativeOwnerBase*>(this), collect);
+        JSNIReleaseGlobalValue(env, jsgval);
+    }
+};
+
+}
+
+// Layout of internal fields: [user fields..., owner, native, type hash]
 template<class T>
 class JSNativeObjectBase : public JSAssociatedObject {
 public:
@@ -272,25 +464,40 @@ public:
         return old;
     }
 
+    // Detach the native and delete it now if the wrapper owns it, instead
+    // of at garbage collection. Native methods called later throw.
+    void dispose() {
+        if (!jsval_)  return;
+        auto owner = get<internal::JSNativeOwnerBase*>(count() - 3);
+        reset(nullptr);
+        if (owner)  owner->release();
+    }
+
 protected:
     JSNativeObjectBase(JSValueRef jsval):
-        JSAssociatedObject(NoCheck(jsval_)) {}
+        JSAssociatedObject(NoCheck(jsval)) {}
 
     JSNativeObjectBase(T* native, unsigned int count,
                        std::function<void(T*)> deleter):
-        JSAssociatedObject(count + 2) {
+        JSAssociatedObject(count + 3) {
         reset(native);
-        if (deleter)
-            JSGlobalValue(jsval_).setGCCallback(std::bind(deleter, native));
+        internal::JSNativeOwnerBase* owner = nullptr;
+        if (deleter && native) {
+            auto typed = new internal::JSNativeOwner<T>(
+                native, std::move(deleter), nullptr);
+            typed->attach(env, jsval_);
+            owner = typed;
+        }
+        set(count, owner);
 
 #ifdef CHECK_NATIVE_TYPE
-        set(count + 1, typeid(T).hash_code());
+        set(count + 2, typeid(T).hash_code());
 #endif
     }
 
     static bool check(JSValueRef jsval) {
         return JSObject::check(jsval) &&
-               JSAssociatedObject(jsval).count() > 1;
+               JSAssociatedObject(jsval).count() > 2;
     }
 
 #ifdef CHECK_NATIVE_TYPE
@@ -328,6 +535,19 @@ public:
     }
 };
 
+#ifdef CHECK_NATIVE_TYPE
+namespace internal {
+
+// the native base class of each class, by hash code, so that wrappers of
+// a derived class pass the type check of its base class
+inline std::unordered_map<size_t, size_t>& native_bases() {
+    return environment_local<std::unordered_map<size_t, size_t>,
+                             JSNativeObjectBase<void>>();
+}
+
+}
+#endif
+
 // TODO: move this to jstypes.h
 template <class T>
 using JSMethodType = JSValue (T::*)(JSObject, JSArray);
@@ -371,35 +591,29 @@ public:
             return false;
 #ifdef CHECK_NATIVE_TYPE
         auto jsobj = JSNativeObjectBase<T>(jsval);
+        // a disposed wrapper has no native to check
+        if (!jsobj.native())
+            return is_compatible(jsobj.hash_code());
         if (std::is_polymorphic<T>::value)
             return dynamic_cast<T*>(jsobj.native()) != nullptr;
-#if __cplusplus >= 201402L
-        if (std::is_final<T>::value)
-            return jsobj.hash_code() == typeid(T).hash_code();
-#endif
-#endif
-        // TODO: support derived non-polymorphic class
+        return is_compatible(jsobj.hash_code());
+#else
         return true;
+#endif
     }
 
-#if 0//def CHECK_NATIVE_TYPE
-    // for type checking
-    template <typename U0, typename U1, typename... Us>
-    static void add_compatible_types() {
-        add_compatible_types<U0>();
-        add_compatible_types<U1, Us...>();
-    }
-    template <typename U>
-    static void add_compatible_types() {
-        compatible_types.insert(std::addressof(typeid(U)));
-    }
+#ifdef CHECK_NATIVE_TYPE
 private:
-    static std::unordered_set<const std::type_info*> compatible_types;
+    static bool is_compatible(size_t hash) {
+        auto& bases = internal::native_bases();
+        while (hash != typeid(T).hash_code()) {
+            auto it = bases.find(hash);
+            if (it == bases.end())  return false;
+            hash = it->second;
+        }
+        return true;
+    }
 #endif
 };
-#if 0//def CHECK_NATIVE_TYPE
-template<class T> std::unordered_set<const std::type_info*>
-JSNativeObject<T, typename std::enable_if<std::is_class<T>::value>::type>::compatible_types;
-#endif
 
 }
@@ -25,7 +25,9 @@
  */
 #pragma once
 
-#include <unordered_set>
+#include <string.h>
+
+#include <array>
 
 #include "jsobject.h"
 #include "jsproperty.h"
@@ -33,14 +35,20 @@
 
 namespace jsni {
 
-inline bool isKnownStaticMethod(const std::string& name) {
-    static std::unordered_set<std::string> methodset {
+namespace internal {
+
+inline const char* object_method_name(JSObjectMethod method) {
+    static const char* const names[ObjectMethodCount] = {
+        "assign",
         "create",
         "defineProperties",
         "defineProperty",
+        "entries",
         "freeze",
         "getOwnPropertyDescriptor",
+        "getOwnPropertyDescriptors",
         "getOwnPropertyNames",
+        "getOwnPropertySymbols",
         "getPrototypeOf",
         "isExtensible",
         "isFrozen",
@@ -48,32 +56,118 @@ inline bool isKnownStaticMethod(const std::string& name) {
         "keys",
         "preventExtensions",
         "seal",
-        // ECMAScript 2015 (6th Edition, ECMA-262)
-        "assign",
-        "getOwnPropertySymbols",
         "setPrototypeOf",
-        // ECMAScript 2017 (ECMA-262)
-        "entries",
-        "getOwnPropertyDescriptors",
-        "values"
+        "values",
+        "is"
     };
-    return methodset.find(name) != methodset.end();
+    return names[method];
+}
+
+// binary search in the sorted names, returns ObjectMethodCount if unknown
+inline JSObjectMethod find_object_method(const char* name) {
+    int low = 0, high = ObjectIs - 1;
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        auto method = static_cast<JSObjectMethod>(mid);
+        int cmp = strcmp(name, object_method_name(method));
+        if (cmp == 0)
+            return method;
+        if (cmp < 0)
+            high = mid - 1;
+        else
+            low = mid + 1;
+    }
+    return ObjectMethodCount;
+}
+
+}
+
+inline bool isKnownStaticMethod(const std::string& name) {
+    return internal::find_object_method(name.c_str()) !=
+           internal::ObjectMethodCount;
+}
+
+inline JSFunction JSObject::staticMethod(internal::JSObjectMethod method) {
+    typedef std::array<JSGlobalValue, internal::ObjectMethodCount> Cache;
+    auto& func = internal::environment_local<Cache, JSFunction>()[method];
+    if (!func)
+        func = JSGlobalValue(constructor()[object_method_name(method)]);
+    return func;
 }
 
 template <typename... Ts>
 JSValue JSObject::callMethod(const std::string& name, Ts&&... args) {
-    return isKnownStaticMethod(name) ?
-            constructor()[name].as(Function)(*this, std::forward<Ts>(args)...) :
+    auto method = internal::find_object_method(name.c_str());
+    return method != internal::ObjectMethodCount ?
+            staticMethod(method)(*this, std::forward<Ts>(args)...) :
             getProperty(name, Function).call(*this, std::forward<Ts>(args)...);
 }
 
+inline void JSObject::setPrototype(JSObject proto) {
+    staticMethod(internal::ObjectSetPrototypeOf)(*this, proto);
+}
+
+inline JSArray JSObject::keys() const {
+    return staticMethod(internal::ObjectKeys)(*this).as(Array);
+}
+inline JSArray JSObject::values() const {
+    return staticMethod(internal::ObjectValues)(*this).as(Array);
+}
+inline JSArray JSObject::entries() const {
+    return staticMethod(internal::ObjectEntries)(*this).as(Array);
+}
+inline JSArray JSObject::getOwnPropertyNames() const {
+    return staticMethod(internal::ObjectGetOwnPropertyNames)(*this).as(Array);
+}
+inline JSArray JSObject::getOwnPropertySymbols() const {
+    return staticMethod(internal::ObjectGetOwnPropertySymbols)(*this).as(Array);
+}
+inline JSValue JSObject::getOwnPropertyDescriptor(
+        const std::string& name) const {
+    return staticMethod(internal::ObjectGetOwnPropertyDescriptor)(*this, name);
+}
+inline JSObject JSObject::getOwnPropertyDescriptors() const {
+    return staticMethod(internal::ObjectGetOwnPropertyDescriptors)(*this)
+            .as(Object);
+}
+inline bool JSObject::defineProperties(JSObject descriptors) {
+    staticMethod(internal::ObjectDefineProperties)(*this, descriptors);
+    return true;
+}
+inline JSObject JSObject::freeze() {
+    return staticMethod(internal::ObjectFreeze)(*this).as(Object);
+}
+inline JSObject JSObject::seal() {
+    return staticMethod(internal::ObjectSeal)(*this).as(Object);
+}
+inline JSObject JSObject::preventExtensions() {
+    return staticMethod(internal::ObjectPreventExtensions)(*this).as(Object);
+}
+inline bool JSObject::isFrozen() const {
+    return staticMethod(internal::ObjectIsFrozen)(*this).as(Boolean);
+}
+inline bool JSObject::isSealed() const {
+    return staticMethod(internal::ObjectIsSealed)(*this).as(Boolean);
+}
+inline bool JSObject::isExtensible() const {
+    return staticMethod(internal::ObjectIsExtensible)(*this).as(Boolean);
+}
+template <typename... Ts>
+JSObject JSObject::assign(Ts&&... sources) {
+    return staticMethod(internal::ObjectAssign)(
+            *this, std::forward<Ts>(sources)...).as(Object);
+}
+inline JSObject JSObject::create(JSValue prototype) {
+    return staticMethod(internal::ObjectCreate)(prototype).as(Object);
+}
+
 inline bool JSObject::defineProperty(const std::string& name,
                                      const JSPropertyDescriptor& descriptor) {
     JSNIPropertyDescriptor desc = descriptor;
     if (desc.data_attributes || desc.accessor_attributes)
         return JSNIDefineProperty(env, jsval_, name.c_str(), desc);
 
-    callMethod("defineProperty", name, descriptor);
+    staticMethod(internal::ObjectDefineProperty)(*this, name, descriptor);
     return true;
 }
 
@@ -88,6 +182,8 @@ inline JSObject::JSObject(JSValueRef jsval): JSValue(jsval) {
 template <class T> template <JSMethodType<T> method>
 bool JSNativeObject<T, typename std::enable_if<std::is_class<T>::value>::type>
                    ::defineMethod(const std::string& name) {
+    // not shared: each object gets its own function with the attributes
+    // of a registered method, so mutating one does not affect the others
     const auto callback = JSNativeMethod<T, method>::thunk;
     return JSNIRegisterMethod(env(), this->jsval_, name.c_str(), callback);
 }
@@ -0,0 +1,310 @@
+/*
+ * Copyright © 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <cassert>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#if __cplusplus >= 201703L
+#include <optional>
+#endif
+
+#include "jsvalue.h"
+#include "jsprimitive.h"
+#include "jsobject.h"
+#include "jsarray.h"
+#include "jstypedarray.h"
+#include "jsfunction.h"
+#include "jsexception.h"
+#include "jsreflect.h"
+
+namespace jsni {
+
+namespace internal {
+
+// kinds of JavaScript values as bits of a mask, a typed array has a bit of
+// its own for each element type
+enum JSArgKind : uint32_t {
+    ArgUndefined = 1 << 0,
+    ArgNull      = 1 << 1,
+    ArgBoolean   = 1 << 2,
+    ArgNumber    = 1 << 3,
+    ArgString    = 1 << 4,
+    ArgSymbol    = 1 << 5,
+    ArgFunction  = 1 << 6,
+    ArgArray     = 1 << 7,
+    ArgObject    = 1 << 8,
+    ArgTypedArray = 1 << 9      // shifted by JsTypedArrayType
+};
+constexpr uint32_t ArgAnyTypedArray =
+    ((1u << (JsArrayTypeFloat64 + 1)) - 1) << 9;
+constexpr uint32_t ArgAnyObject =
+    ArgObject | ArgArray | ArgFunction | ArgAnyTypedArray;
+constexpr uint32_t ArgAny = (ArgTypedArray << (JsArrayTypeFloat64 + 1)) - 1;
+
+inline uint32_t classify_arg(JSNIEnv* env, JSValueRef jsval) {
+    if (JSNIIsNumber(env, jsval))     return ArgNumber;
+    if (JSNIIsString(env, jsval))     return ArgString;
+    if (JSNIIsBoolean(env, jsval))    return ArgBoolean;
+    if (JSNIIsUndefined(env, jsval))  return ArgUndefined;
+    if (JSNIIsNull(env, jsval))       return ArgNull;
+    if (JSNIIsSymbol(env, jsval))     return ArgSymbol;
+    if (JSNIIsFunction(env, jsval))   return ArgFunction;
+    if (JSNIIsArray(env, jsval))      return ArgArray;
+    if (JSNIIsTypedArray(env, jsval))
+        return ArgTypedArray << JSNIGetTypedArrayType(env, jsval);
+    return ArgObject;
+}
+
+inline const char* arg_kind_name(uint32_t kind) {
+    static const char* const names[] = {
+        "undefined", "null", "boolean", "number", "string", "symbol",
+        "function", "Array", "Object"
+    };
+    if (kind & ArgAnyTypedArray)  return "TypedArray";
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+        if (kind & (1u << i))  return names[i];
+    return "?";
+}
+
+// kinds accepted by a parameter of C++ type T
+constexpr uint32_t arg_mask(const JSValue*) {
+    return ArgAny;
+}
+constexpr uint32_t arg_mask(const JSObject*) {
+    return ArgAnyObject;
+}
+constexpr uint32_t arg_mask(const JSArray*) {
+    return ArgArray;
+}
+constexpr uint32_t arg_mask(const JSFunction*) {
+    return ArgFunction;
+}
+constexpr uint32_t arg_mask(const JSNumber*) {
+    return ArgNumber;
+}
+constexpr uint32_t arg_mask(const JSString*) {
+    return ArgString;
+}
+constexpr uint32_t arg_mask(const JSBoolean*) {
+    return ArgBoolean;
+}
+constexpr uint32_t arg_mask(const JSSymbol*) {
+    return ArgSymbol;
+}
+template <typename U, bool clamped>
+constexpr uint32_t arg_mask(const JSTypedArray<U, clamped>*) {
+    return std::is_void<U>::value ? ArgAnyTypedArray :
+           ArgTypedArray << JSTypedArray<U, clamped>::type();
+}
+template <typename U>
+constexpr uint32_t arg_mask(const JSNativeObject<U>*) {
+    return ArgObject;
+}
+constexpr uint32_t arg_mask(const bool*) {
+    return ArgBoolean;
+}
+constexpr uint32_t arg_mask(const std::string*) {
+    return ArgString;
+}
+template <typename T>
+constexpr uint32_t arg_mask(const std::vector<T>*) {
+    return ArgArray;
+}
+#if __cplusplus >= 201703L
+template <typename T>
+constexpr uint32_t arg_mask(const std::optional<T>*) {
+    return arg_mask(static_cast<const T*>(nullptr)) | ArgUndefined | ArgNull;
+}
+#endif
+template <typename T>
+constexpr typename std::enable_if<std::is_arithmetic<T>::value, uint32_t>::type
+arg_mask(const T*) {
+    return ArgNumber;
+}
+// reflected struct or map
+template <typename T>
+constexpr typename std::enable_if<!std::is_arithmetic<T>::value &&
+                                  !std::is_base_of<JSValue, T>::value,
+                                  uint32_t>::type
+arg_mask(const T*) {
+    return ArgObject;
+}
+
+// checks of a parameter beyond its kind, native objects of different
+// classes are told apart by their type check
+template <typename T>
+inline bool arg_check(const T*, JSValueRef) {
+    return true;
+}
+template <typename U>
+inline bool arg_check(const JSNativeObject<U>*, JSValueRef jsval) {
+    return JSNativeObject<U>::check(jsval);
+}
+#if __cplusplus >= 201703L
+template <typename T>
+inline bool arg_check(const std::optional<T>*, JSValueRef jsval) {
+    JSNIEnv* env = jsni::env();
+    return JSNIIsUndefined(env, jsval) || JSNIIsNull(env, jsval) ||
+           arg_check(static_cast<const T*>(nullptr), jsval);
+}
+#endif
+
+template <typename R>
+struct JSOverloadCall {
+    template <typename F, typename... Ts>
+    static JSValue call(F function, Ts&&... args) {
+        return JSConvert<R>::to(function(std::forward<Ts>(args)...));
+    }
+};
+template <>
+struct JSOverloadCall<void> {
+    template <typename F, typename... Ts>
+    static JSValue call(F function, Ts&&... args) {
+        function(std::forward<Ts>(args)...);
+        return JSUndefined();
+    }
+};
+
+}
+
+// One C++ overload of a JavaScript function, e.g.
+//   JSOverload<decltype(&scale), &scale>
+// Arguments and the result are converted by JSConvert.
+template <typename F, F function>
+struct JSOverload;
+
+template <typename R, typename... Args, R (*function)(Args...)>
+struct JSOverload<R (*)(Args...), function> {
+    static constexpr size_t arity = sizeof...(Args);
+
+    static const uint32_t* masks() {
+        static constexpr uint32_t masks[arity + 1] = {
+            internal::arg_mask(static_cast<
+                const typename std::decay<Args>::type*>(nullptr))..., 0
+        };
+        return masks;
+    }
+    static bool accepts(const JSValueRef* argv) {
+        return accepts(argv, std::index_sequence_for<Args...>());
+    }
+    static JSValue invoke(const JSValueRef* argv) {
+        return invoke(argv, std::index_sequence_for<Args...>());
+    }
+
+private:
+    template <size_t... I>
+    static bool accepts(const JSValueRef* argv, std::index_sequence<I...>) {
+        bool ok = true;
+        int unused[] = { 0, (ok = ok && internal::arg_check(static_cast<
+            const typename std::decay<Args>::type*>(nullptr), argv[I]), 0)...
+        };
+        (void)unused;
+        (void)argv;
+        return ok;
+    }
+    template <size_t... I>
+    static JSValue invoke(const JSValueRef* argv, std::index_sequence<I...>) {
+        (void)argv;
+        return internal::JSOverloadCall<R>::call(function,
+            JSConvert<typename std::decay<Args>::type>::from(argv[I])...);
+    }
+};
+
+template <typename R, typename... Args, R (*function)(Args...)>
+constexpr size_t JSOverload<R (*)(Args...), function>::arity;
+
+// Native function with several overloads. The kinds of the arguments are
+// classified once per call and matched against the parameter masks of the
+// overloads in order, the first match is called. This is a linear scan of
+// a static table rather than a dispatch table indexed by kinds, overload
+// sets are small. Native object parameters also need the type check of
+// their class to pass, which only tells classes apart when the native type
+// is checked. Missing trailing arguments are undefined, so they match
+// optional parameters. TypeError is thrown if no overload matches.
+template <typename... Overloads>
+class JSNativeOverloadedFunction : public JSFunction {
+public:
+    JSNativeOverloadedFunction(): JSFunction(cached(thunk)) {}
+
+    JSNativeOverloadedFunction(const std::string& name):
+        JSFunction(cached(thunk, name)) {}
+
+private:
+    struct Entry {
+        size_t arity;
+        const uint32_t* masks;
+        bool (*accepts)(const JSValueRef*);
+        JSValue (*invoke)(const JSValueRef*);
+    };
+    static constexpr size_t max_arity =
+        std::max({size_t(0), Overloads::arity...});
+
+    static void thunk(JSNIEnv* env, const JSNICallbackInfo info) {
+        assert(env == JSValue::env);
+        static const Entry table[] = {
+            { Overloads::arity, Overloads::masks(),
+              Overloads::accepts, Overloads::invoke }...
+        };
+        internal::guard([&] {
+            size_t argc = JSNIGetArgsLengthOfCallback(env, info);
+            JSValueRef argv[max_arity + 1] = {};
+            uint32_t kinds[max_arity + 1] = {};
+            for (size_t i = 0; i < argc && i < max_arity; ++i) {
+                argv[i] = JSNIGetArgOfCallback(env, info, i);
+                kinds[i] = internal::classify_arg(env, argv[i]);
+            }
+            // missing trailing arguments are undefined
+            for (size_t i = argc; i < max_arity; ++i) {
+                argv[i] = JSNINewUndefined(env);
+                kinds[i] = internal::ArgUndefined;
+            }
+            for (const Entry& entry: table) {
+                if (entry.arity < argc)  continue;
+                size_t i = 0;
+                while (i < entry.arity && (entry.masks[i] & kinds[i]))  ++i;
+                if (i == entry.arity && entry.accepts(argv)) {
+                    JSNISetReturnValue(env, info, entry.invoke(argv));
+                    return;
+                }
+            }
+            std::string message = "No overload matches (";
+            for (size_t i = 0; i < argc; ++i) {
+                if (i)  message += ", ";
+                message += i < max_arity ?
+                    internal::arg_kind_name(kinds[i]) : "...";
+            }
+            JSException::raise(JSException::TypeError, message + ")");
+        });
+    }
+};
+
+}
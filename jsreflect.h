@@ -0,0 +1,234 @@
+/*
+ * Copyright © 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+#if __cplusplus >= 201703L
+#include <optional>
+#endif
+
+#include "apply.h"
+#include "jsprimitive.h"
+#include "jsobject.h"
+#include "jsarray.h"
+#include "jstemplate.h"
+
+namespace jsni {
+
+// Converter between native values and JavaScript values:
+//   static JSValue to(const T& value);
+//   static T from(JSValue jsval);
+template <typename T, typename = void>
+struct JSConvert;
+
+template <typename T>
+JSValue to_js(const T& value) {
+    return JSConvert<T>::to(value);
+}
+template <typename T>
+T from_js(JSValue jsval) {
+    return JSConvert<T>::from(jsval);
+}
+
+// A field of struct T. A struct is reflected by specializing JSReflection:
+//
+//   template <> struct jsni::JSReflection<Point> {
+//       static constexpr auto fields() {
+//           return std::make_tuple(jsni::field("x", &Point::x),
+//                                  jsni::field("y", &Point::y));
+//       }
+//   };
+template <class T, typename M>
+struct JSField {
+    typedef M type;
+    const char* name;
+    M T::*member;
+};
+template <class T, typename M>
+constexpr JSField<T, M> field(const char* name, M T::*member) {
+    return JSField<T, M> { name, member };
+}
+
+template <class T>
+struct JSReflection;
+
+namespace internal {
+
+template <typename...>
+struct make_void {
+    typedef void type;
+};
+template <class T, typename = void>
+struct is_reflected : std::false_type {};
+template <class T>
+struct is_reflected<T, typename make_void<
+        decltype(JSReflection<T>::fields())>::type> : std::true_type {};
+
+}
+
+template <typename T>
+struct JSConvert<T, typename std::enable_if<
+        std::is_base_of<JSValue, T>::value>::type> {
+    static JSValue to(const T& value) {
+        return value;
+    }
+    static T from(JSValue jsval) {
+        return jsval.to<T>();
+    }
+};
+
+template <>
+struct JSConvert<bool> {
+    static JSValue to(bool value) {
+        return JSBoolean(value);
+    }
+    static bool from(JSValue jsval) {
+        return jsval.to(Boolean);
+    }
+};
+
+template <typename T>
+struct JSConvert<T, typename std::enable_if<
+        std::is_arithmetic<T>::value>::type> {
+    static JSValue to(T value) {
+        return JSNumber(value);
+    }
+    static T from(JSValue jsval) {
+        return static_cast<T>(jsval.to(Number));
+    }
+};
+
+template <>
+struct JSConvert<std::string> {
+    static JSValue to(const std::string& value) {
+        return JSString(value);
+    }
+    static std::string from(JSValue jsval) {
+        return jsval.to(String);
+    }
+};
+
+// std::vector <-> Array, local handles are recycled for long vectors
+template <typename T>
+struct JSConvert<std::vector<T>> {
+    static JSValue to(const std::vector<T>& value) {
+        JSArray array(value.size());
+        for_each_scoped(0, value.size(), [&](size_t index) {
+            array.setElement(index, JSConvert<T>::to(value[index]));
+        });
+        return array;
+    }
+    static std::vector<T> from(JSValue jsval) {
+        std::vector<T> value;
+        if (!jsval.is(Array))  return value;
+        auto array = jsval.as(Array);
+        value.reserve(array.length());
+        array.forEach([&](JSValue element, size_t) {
+            value.push_back(JSConvert<T>::from(element));
+        });
+        return value;
+    }
+};
+
+// map with string keys <-> Object
+template <typename T>
+struct JSConvert<T, typename std::enable_if<
+        std::is_same<typename T::key_type, std::string>::value &&
+        !std::is_same<typename T::key_type,
+                      typename T::value_type>::value>::type> {
+    typedef typename T::mapped_type M;
+    static JSValue to(const T& value) {
+        JSObject object;
+        for (auto&& p: value) {
+            JSScope scope;
+            object.setProperty(p.first, JSConvert<M>::to(p.second));
+        }
+        return object;
+    }
+    static T from(JSValue jsval) {
+        T value;
+        if (!jsval.is(Object))  return value;
+        auto object = jsval.as(Object);
+        object.keys().forEach([&](JSValue key, size_t) {
+            std::string name = key.as(String);
+            value.emplace(name, JSConvert<M>::from(object[name]));
+        });
+        return value;
+    }
+};
+
+#if __cplusplus >= 201703L
+// std::nullopt <-> null / undefined
+template <typename T>
+struct JSConvert<std::optional<T>> {
+    static JSValue to(const std::optional<T>& value) {
+        return value ? JSConvert<T>::to(*value) : JSNull();
+    }
+    static std::optional<T> from(JSValue jsval) {
+        if (!jsval || jsval.is(Null) || jsval.is(Undefined))
+            return std::nullopt;
+        return JSConvert<T>::from(jsval);
+    }
+};
+#endif
+
+// reflected struct <-> Object, keys are kept in a JSObjectTemplate
+template <class T>
+struct JSConvert<T, typename std::enable_if<
+        internal::is_reflected<T>::value>::type> {
+    static JSValue to(const T& value) {
+        static const JSObjectTemplate shape = jsni::apply(
+            [](const auto&... fields) {
+                return JSObjectTemplate { fields.name... };
+            }, JSReflection<T>::fields());
+        return jsni::apply([&](const auto&... fields) {
+            return shape.newInstance(to_js(value.*(fields.member))...);
+        }, JSReflection<T>::fields());
+    }
+    static T from(JSValue jsval) {
+        T value {};
+        if (!jsval.is(Object))  return value;
+        JSValueRef jsobj = jsval;
+        jsni::apply([&](const auto&... fields) {
+            int unused[] = { 0, (from_field(value, jsobj, fields), 0)... };
+            (void)unused;
+        }, JSReflection<T>::fields());
+        return value;
+    }
+
+private:
+    template <typename M>
+    static void from_field(T& value, JSValueRef jsobj,
+                           const JSField<T, M>& field) {
+        value.*(field.member) =
+            JSConvert<M>::from(JSNIGetProperty(env(), jsobj, field.name));
+    }
+};
+
+}
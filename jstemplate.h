@@ -0,0 +1,118 @@
+/*
+ * Copyright © 2016 Intel Corporation. All Rights Reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR IMPLIED
+ * WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+ * EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <initializer_list>
+#include <iterator>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "apply.h"
+#include "jsobject.h"
+#include "jsarray.h"
+
+namespace jsni {
+
+// A template of objects which have the same keys. Properties of instances
+// are always added in the declared order, so the engine sees a stable
+// hidden class. The keys are kept by the template, no string is built for
+// each instance.
+//
+//   JSObjectTemplate point { "x", "y" };
+//   JSObject p = point.newInstance(1.0, 2.0);
+//   JSArray ps = point.newInstances(points, [](const Point& p) {
+//       return std::make_tuple(p.x, p.y);
+//   });
+class JSObjectTemplate {
+public:
+    JSObjectTemplate(std::initializer_list<std::string> keys):
+        keys_(keys) {}
+    template <class T, typename = typename std::enable_if<
+            std::is_constructible<std::string, typename T::value_type>::value>::type>
+    explicit JSObjectTemplate(const T& keys):
+        keys_(keys.begin(), keys.end()) {}
+
+    size_t size() const {
+        return keys_.size();
+    }
+    const std::string& key(size_t index) const {
+        return keys_[index];
+    }
+
+    // values are in the order of keys, extra values are ignored and keys
+    // without a value are not set
+    template <typename... Ts>
+    JSObject newInstance(Ts&&... values) const {
+        assert(sizeof...(Ts) == keys_.size());
+        JSValueRef argv[sizeof...(Ts) + 1] = {
+            value_ref(std::forward<Ts>(values))...
+        };
+        return create(argv, sizeof...(Ts));
+    }
+
+    // create an instance for each row, which is a tuple of values
+    template <class T>
+    JSArray newInstances(const T& rows, size_t chunk = 1024) const {
+        return newInstances(rows, [](const typename T::value_type& row)
+                -> const typename T::value_type& {
+            return row;
+        }, chunk);
+    }
+    // create an instance for each row, fields(row) returns a tuple of values
+    template <class T, typename F>
+    JSArray newInstances(const T& rows, F&& fields,
+                         size_t chunk = 1024) const {
+        JSArray array(std::distance(rows.begin(), rows.end()));
+        auto it = rows.begin();
+        auto make = [this](auto&&... values) {
+            return newInstance(std::forward<decltype(values)>(values)...);
+        };
+        for_each_scoped(0, array.length(), [&](size_t index) {
+            array.setElement(index, jsni::apply(make, fields(*it)));
+            ++it;
+        }, chunk);
+        return array;
+    }
+
+private:
+    JSObject create(const JSValueRef* values, size_t count) const {
+        JSObject object;
+        count = std::min(count, keys_.size());
+        for (size_t i = 0; i < count; ++i)
+            JSNISetProperty(env(), object, keys_[i].c_str(), values[i]);
+        return object;
+    }
+    static JSValueRef value_ref(JSValue jsval) {
+        return jsval;
+    }
+
+    std::vector<std::string> keys_;
+};
+
+}
@@ -26,7 +26,9 @@
 #pragma once
 
 #include <cassert>
+#include <functional>
 #include <type_traits>
+#include <vector>
 
 #include "jsobject.h"
 
@@ -47,8 +49,20 @@ public:
     }
 
     JSTypedArray(): JSTypedArray(nullptr, 0) {}
-    JSTypedArray(T* data, size_t length):  // TODO: support deleter
+    // the data must outlive the array
+    JSTypedArray(T* data, size_t length):
         JSObject(NoCheck(JSNINewTypedArray(env, type(), data, length))) {}
+    // the data is released by deleter when the array is garbage collected
+    JSTypedArray(T* data, size_t length, std::function<void(T*)> deleter):
+        JSTypedArray(data, length) {
+        if (deleter)
+            JSGlobalValue(*this).setGCCallback(std::bind(deleter, data));
+    }
+    // take over the memory of a vector without copying
+    template <typename U, typename = typename
+              std::enable_if<std::is_same<U, T>::value>::type>
+    explicit JSTypedArray(std::vector<U>&& data):
+        JSTypedArray(adopt(std::move(data))) {}
 
     size_t length() const {
         return JSNIGetTypedArrayLength(env, jsval_);
@@ -81,6 +95,20 @@ public:
                    JSNIGetTypedArrayType(env, value) == type()
                );
     }
+
+private:
+    template <typename U>
+    static JSTypedArray adopt(std::vector<U>&& data) {
+        // an empty vector may have no storage, there is nothing to adopt
+        if (data.empty()) {
+            static U none;
+            return JSTypedArray(&none, 0);
+        }
+        auto holder = new std::vector<U>(std::move(data));
+        return JSTypedArray(holder->data(), holder->size(), [holder](U*) {
+            delete holder;
+        });
+    }
 };
 /*
 template<typename T, bool clamped>
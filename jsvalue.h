@@ -27,27 +27,57 @@
 
 #include <string.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <functional>
 #include <initializer_list>
+#include <memory>
 #include <string>
 #include <type_traits>
+#include <unordered_map>
 
 #include <jsni.h>
 
+//#include <JSNIHelper.h>
+extern "C" {
+typedef void (*AsyncThreadWorkCallback)(JSNIEnv* env, void*);
+typedef void (*AsyncThreadWorkAfterCallback)(JSNIEnv* env, void*);
+void AsyncThreadWork(JSNIEnv* env, void* data,
+                     AsyncThreadWorkCallback work,
+                     AsyncThreadWorkAfterCallback callback);
+}
+
 namespace jsni {
 
 namespace internal {
 
+// Each thread drives at most one JavaScript engine instance at a time, so
+// the environment is kept in thread local storage.
 template <typename Dummy>
 struct _JSGlobalEnvironment {
-    static JSNIEnv* env;
+    static thread_local JSNIEnv* env;
 };
 template <typename Dummy>
-JSNIEnv* _JSGlobalEnvironment<Dummy>::env = NULL;
+thread_local JSNIEnv* _JSGlobalEnvironment<Dummy>::env = NULL;
 
 typedef _JSGlobalEnvironment<void> JSGlobalEnvironment;
 
+// Per environment storage of T. Tag distinguishes storages of same type.
+template <typename T, typename Tag = void>
+T& environment_local() {
+    static thread_local std::unordered_map<JSNIEnv*, T> values;
+    static thread_local JSNIEnv* last_env = NULL;
+    static thread_local T* last_value = nullptr;
+
+    JSNIEnv* env = JSGlobalEnvironment::env;
+    if (env != last_env || !last_value) {
+        last_value = &values[env];
+        last_env = env;
+    }
+    return *last_value;
+}
+
 }
 
 inline JSNIEnv* env() {
@@ -57,6 +87,23 @@ inline int version() {
     return JSNIGetVersion(env());
 }
 
+// Switch the environment of current thread temporarily.
+class JSEnvironmentScope final {
+public:
+    explicit JSEnvironmentScope(JSNIEnv* env):
+        saved_(internal::JSGlobalEnvironment::env) {
+        internal::JSGlobalEnvironment::env = env;
+    }
+    ~JSEnvironmentScope() {
+        internal::JSGlobalEnvironment::env = saved_;
+    }
+    JSEnvironmentScope(const JSEnvironmentScope&) = delete;
+    JSEnvironmentScope& operator =(const JSEnvironmentScope&) = delete;
+
+private:
+    JSNIEnv* saved_;
+};
+
 
 class JSValue;
 class JSUndefined;
@@ -165,61 +212,171 @@ protected:
     JSValueRef jsval_;
 };
 
-#if 1
+namespace internal {
+
+template <bool atomic>
+struct JSGlobalValueBlock;
 
-class JSGlobalValue {
+// reference counting policies
+template <>
+struct JSGlobalValueBlock<false> {
+    typedef size_t counter_type;
+    static void acquire(counter_type& count) {
+        ++count;
+    }
+    static bool release(counter_type& count) {
+        return --count == 0;
+    }
+};
+template <>
+struct JSGlobalValueBlock<true> {
+    typedef std::atomic<size_t> counter_type;
+    static void acquire(counter_type& count) {
+        count.fetch_add(1, std::memory_order_relaxed);
+    }
+    static bool release(counter_type& count) {
+        return count.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+};
+
+// Global references dropped in other threads are pushed onto the release
+// queue of their environment, then released in batch in the JavaScript
+// thread. There is one queue per environment, which is never freed.
+class JSReleaseQueue final {
+public:
+    explicit JSReleaseQueue(JSNIEnv* env): env_(env), head_(nullptr) {}
+
+    JSNIEnv* env() const {
+        return env_;
+    }
+
+    // can be called in any thread
+    void release(JSGlobalValueRef jsgval) {
+        if (JSGlobalEnvironment::env == env_) {
+            JSNIReleaseGlobalValue(env_, jsgval);
+            return;
+        }
+        auto node = new Node { jsgval, head_.load(std::memory_order_relaxed) };
+        while (!head_.compare_exchange_weak(node->next, node,
+                                            std::memory_order_release,
+                                            std::memory_order_relaxed));
+        // schedule a drain when the queue turns to non-empty
+        if (!node->next)
+            AsyncThreadWork(env_, this, [](JSNIEnv*, void*){}, drain);
+    }
+
+    // must be called in the JavaScript thread
+    void drain() {
+        assert(JSGlobalEnvironment::env == env_);
+        if (!head_.load(std::memory_order_relaxed))  return;
+        Node* node = head_.exchange(nullptr, std::memory_order_acquire);
+        while (node) {
+            JSNIReleaseGlobalValue(env_, node->jsgval);
+            Node* next = node->next;
+            delete node;
+            node = next;
+        }
+    }
+
+    // queue of current environment
+    static JSReleaseQueue* current() {
+        auto& queue = environment_local<JSReleaseQueue*, JSReleaseQueue>();
+        if (!queue)  queue = new JSReleaseQueue(JSGlobalEnvironment::env);
+        return queue;
+    }
+
+private:
+    struct Node {
+        JSGlobalValueRef jsgval;
+        Node* next;
+    };
+    static void drain(JSNIEnv* env, void* data) {
+        JSEnvironmentScope scope(env);
+        reinterpret_cast<JSReleaseQueue*>(data)->drain();
+    }
+
+    JSNIEnv* env_;
+    std::atomic<Node*> head_;
+};
+
+// number of JSNI global references held by jsnipp
+template <typename Dummy>
+struct _JSGlobalValueCounter {
+    static std::atomic<size_t> count;
+};
+template <typename Dummy>
+std::atomic<size_t> _JSGlobalValueCounter<Dummy>::count{0};
+
+typedef _JSGlobalValueCounter<void> JSGlobalValueCounter;
+
+}
+
+// A global value owns one JSNI global reference which is shared by all
+// copies through a reference count on C++ side, so copying and moving a
+// global value never cross the JSNI boundary. The JSNI reference belongs
+// to the environment in which it was created, the last copy can be dropped
+// in any thread (see internal::JSReleaseQueue).
+template <bool atomic = true>
+class JSBasicGlobalValue {
 public:
     // construct with raw JSGlobalRef value
-    constexpr JSGlobalValue(std::nullptr_t = nullptr): jsgval_(nullptr) {}
-    JSGlobalValue(JSGlobalValueRef jsgval): jsgval_(jsgval) {
-        if (jsgval_)  JSNIAcquireGlobalValue(env(), jsgval_);
+    constexpr JSBasicGlobalValue(std::nullptr_t = nullptr): block_(nullptr) {}
+    JSBasicGlobalValue(JSGlobalValueRef jsgval): block_(adopt(jsgval)) {
+        if (jsgval)  JSNIAcquireGlobalValue(block_->env(), jsgval);
     }
-    JSGlobalValue(JSGlobalValueRef&& jsgval): jsgval_(jsgval) {
+    JSBasicGlobalValue(JSGlobalValueRef&& jsgval): block_(adopt(jsgval)) {
         jsgval = nullptr;
     }
-    ~JSGlobalValue() {
-        if (jsgval_)  JSNIReleaseGlobalValue(env(), jsgval_);
+    ~JSBasicGlobalValue() {
+        release();
     }
 
     // copy / move constructors
-    JSGlobalValue(const JSGlobalValue& that):
-        JSGlobalValue(that.jsgval_) {}
-    JSGlobalValue(JSGlobalValue&& that): jsgval_(that.jsgval_) {
-        that.jsgval_ = nullptr;
+    JSBasicGlobalValue(const JSBasicGlobalValue& that): block_(that.block_) {
+        if (block_)  Block::acquire(block_->count);
+    }
+    JSBasicGlobalValue(JSBasicGlobalValue&& that): block_(that.block_) {
+        that.block_ = nullptr;
     }
 
     // converting constructor for local value
-    explicit JSGlobalValue(const JSValue& jsval):
-        jsgval_(JSNINewGlobalValue(env(), jsval)) {}
+    explicit JSBasicGlobalValue(const JSValue& jsval):
+        block_(adopt(JSNINewGlobalValue(env(), jsval))) {}
 
-    JSGlobalValue& operator =(const JSGlobalValue& that) {
-        if (jsgval_)  JSNIReleaseGlobalValue(env(), jsgval_);
-        jsgval_ = that.jsgval_;
-        if (jsgval_)  JSNIAcquireGlobalValue(env(), jsgval_);
+    JSBasicGlobalValue& operator =(const JSBasicGlobalValue& that) {
+        if (that.block_)  Block::acquire(that.block_->count);
+        release();
+        block_ = that.block_;
         return *this;
     }
-    JSGlobalValue& operator =(JSGlobalValue&& that) {
-        if (jsgval_)  JSNIReleaseGlobalValue(env(), jsgval_);
-        jsgval_ = that.jsgval_;
-        that.jsgval_ = nullptr;
+    JSBasicGlobalValue& operator =(JSBasicGlobalValue&& that) {
+        if (this == &that)  return *this;
+        release();
+        block_ = that.block_;
+        that.block_ = nullptr;
         return *this;
     }
 
     explicit operator bool() const {
-        return jsgval_ != nullptr;
+        return block_ != nullptr;
     }
 
     // convert to local value
     template <typename T, typename = typename
               std::enable_if<std::is_base_of<JSValue, T>::value>::type>
     operator T() const {
-        assert(jsgval_);
-        return T(JSNIGetGlobalValue(env(), jsgval_));
+        assert(block_ && block_->env() == env());
+        return T(JSNIGetGlobalValue(block_->env(), block_->jsgval));
     }
 
     // get raw value
     operator JSGlobalValueRef() const {
-        return jsgval_;
+        return block_ ? block_->jsgval : nullptr;
+    }
+
+    // the owner environment
+    JSNIEnv* environment() const {
+        return block_ ? block_->env() : nullptr;
     }
 
     // compare with JSValue
@@ -233,7 +390,8 @@ public:
     void setGCCallback(const std::function<void()>& callback) {
         assert(*this && callback);
         auto data = new std::function<void()>(callback);
-        JSNISetGCCallback(env(), jsgval_, data, [](JSNIEnv*, void* data){
+        JSNISetGCCallback(block_->env(), block_->jsgval, data,
+                          [](JSNIEnv*, void* data) {
             auto callback = reinterpret_cast<std::function<void()>*>(data);
             (*callback)();
             delete callback;
@@ -241,99 +399,159 @@ public:
     }
     //void setGCCallback(const std::function<void(JSValue)>& callback);
 
-private:
-    JSGlobalValueRef jsgval_;
-};
-
-#else
-
-using _JSGlobalValue =
-    std::shared_ptr<std::remove_pointer<JSGlobalValueRef>::type>;
-class JSGlobalValue: _JSGlobalValue {
-public:
-    JSGlobalValue(std::nullptr_t = nullptr):
-        _JSGlobalValue(nullptr, Deleter()) {}
-    JSGlobalValue(JSGlobalValueRef jsgval):
-        _JSGlobalValue(jsgval, Deleter()) {}
-
-    // copy / move constructors
-    JSGlobalValue(const JSGlobalValue& that):
-        _JSGlobalValue(that) {};
-    JSGlobalValue(JSGlobalValue&& that):
-        _JSGlobalValue(that) {};
+    // number of live JSNI global references, for debugging
+    static size_t live_count() {
+        return internal::JSGlobalValueCounter::count.load();
+    }
 
-    // converting constructor for local value
-    explicit JSGlobalValue(JSValue jsval):
-        JSGlobalValue(JSNINewGlobalValue(env(), jsval)) {}
+private:
+    struct Block : internal::JSGlobalValueBlock<atomic> {
+        explicit Block(JSGlobalValueRef jsgval):
+            queue(internal::JSReleaseQueue::current()),
+            jsgval(jsgval), count(1) {
+            queue->drain();
+            internal::JSGlobalValueCounter::count.fetch_add(
+                    1, std::memory_order_relaxed);
+        }
+        ~Block() {
+            queue->release(jsgval);
+            internal::JSGlobalValueCounter::count.fetch_sub(
+                    1, std::memory_order_relaxed);
+        }
+        JSNIEnv* env() const {
+            return queue->env();
+        }
+        internal::JSReleaseQueue* queue;
+        JSGlobalValueRef jsgval;
+        typename internal::JSGlobalValueBlock<atomic>::counter_type count;
+    };
 
-    JSGlobalValue& operator =(const JSGlobalValue& that) {
-        _JSGlobalValue::operator=(that);
-        return *this;
+    static Block* adopt(JSGlobalValueRef jsgval) {
+        return jsgval ? new Block(jsgval) : nullptr;
     }
-    JSGlobalValue& operator =(JSGlobalValue&& that) {
-        _JSGlobalValue::operator=(that);
-        return *this;
+    void release() {
+        if (block_ && Block::release(block_->count))
+            delete block_;
+        block_ = nullptr;
     }
 
-    explicit operator bool() const {
-        return _JSGlobalValue::operator bool();
-    }
+    Block* block_;
+};
 
-    // convert to local value
-    template <typename T, typename = typename
-              std::enable_if<std::is_base_of<JSValue, T>::value>::type>
-    operator T() const {
-        assert(get());
-        return T(JSNIGetGlobalValue(env(), get()));
-    }
+// shared between threads
+typedef JSBasicGlobalValue<true> JSGlobalValue;
+// used in one thread only, without atomic operations
+typedef JSBasicGlobalValue<false> JSUnsafeGlobalValue;
 
-    // get raw value
-    operator JSGlobalValueRef() const {
-        return get();
+// A weak reference which doesn't keep the JavaScript value alive. The
+// optional callback is called when the value is garbage collected.
+class JSWeakValue {
+public:
+    JSWeakValue(std::nullptr_t = nullptr) {}
+    explicit JSWeakValue(const JSValue& jsval,
+                         std::function<void()> callback = nullptr):
+        state_(std::make_shared<State>()) {
+        state_->env = env();
+        state_->jsgval = JSNINewGlobalValue(state_->env, jsval);
+        state_->alive = true;
+        state_->callback = std::move(callback);
+        JSNISetGCCallback(state_->env, state_->jsgval,
+                          new std::shared_ptr<State>(state_),
+                          [](JSNIEnv*, void* data) {
+            auto state = reinterpret_cast<std::shared_ptr<State>*>(data);
+            (*state)->alive = false;
+            if ((*state)->callback)
+                (*state)->callback();
+            delete state;
+        });
+        // drop the strong reference, the value becomes weak
+        JSNIReleaseGlobalValue(state_->env, state_->jsgval);
     }
 
-    // compare with JSValue
-    bool operator ==(const JSValue& that) const {
-        return that == *this;
-    }
-    bool operator !=(const JSValue& that) const {
-        return that != *this;
+    bool expired() const {
+        return !state_ || !state_->alive;
     }
 
-    void setGCCallback(const std::function<void()>& callback) {
-        assert(get() && callback);
-        auto data = new std::function<void()>(callback);
-        JSNISetGCCallback(env(), get(), data, [](JSNIEnv*, void* data){
-            auto callback = reinterpret_cast<std::function<void()>*>(data);
-            (*callback)();
-            delete callback;
-        });
+    // returns an empty value if expired
+    JSValue lock() const {
+        if (expired())  return JSValue();
+        assert(state_->env == env());
+        return JSNIGetGlobalValue(state_->env, state_->jsgval);
     }
 
 private:
-    struct Deleter {
-        void operator()(JSGlobalValueRef jsgval) const {
-            if (jsgval) JSNIDeleteGlobalValue(env(), jsgval);
-        }
+    struct State {
+        JSNIEnv* env;
+        JSGlobalValueRef jsgval;
+        bool alive;
+        std::function<void()> callback;
     };
+    std::shared_ptr<State> state_;
 };
-#endif
 
-class JSScope {
+class JSScope final {
 public:
-    JSScope(): slot_() {
+    JSScope() {
         JSNIPushLocalScope(env());
     }
     ~JSScope() {
         JSNIPopLocalScope(env());
     }
-    JSValue& escape(JSValue jsval) {
-        return slot_ = jsval;
+    JSScope(const JSScope&) = delete;
+    JSScope& operator =(const JSScope&) = delete;
+};
+
+// A local scope which promotes one value to the enclosing scope.
+// Escaping a value closes the scope.
+class JSEscapableScope final {
+public:
+    JSEscapableScope(): open_(true) {
+        JSNIPushEscapableLocalScope(env());
+    }
+    ~JSEscapableScope() {
+        if (open_)  JSNIPopEscapableLocalScope(env(), JSNINewUndefined(env()));
+    }
+    JSEscapableScope(const JSEscapableScope&) = delete;
+    JSEscapableScope& operator =(const JSEscapableScope&) = delete;
+
+    template <typename T>
+    T escape(T jsval) {
+        assert(open_);
+        open_ = false;
+        return JSValue(JSNIPopEscapableLocalScope(env(), jsval)).as<T>();
     }
+
 private:
-    JSValue slot_;
+    bool open_;
+};
+
+struct JSScopeStats {
+    size_t iterations;  // number of iterations
+    size_t scopes;      // number of local scopes opened
+    size_t peak;        // max iterations run in a local scope
 };
 
+// Call f(index) for each index in [begin, end). A new local scope is opened
+// every `chunk` iterations, so the count of local handles doesn't grow with
+// the length of the loop. Values to keep must be stored in an object
+// created outside of the loop or in a global value.
+template <typename F>
+JSScopeStats for_each_scoped(size_t begin, size_t end, F&& f,
+                             size_t chunk = 1024) {
+    assert(chunk > 0);
+    JSScopeStats stats { 0, 0, 0 };
+    for (size_t index = begin; index < end; ) {
+        size_t limit = std::min(end, index + chunk);
+        JSScope scope;
+        ++stats.scopes;
+        stats.peak = std::max(stats.peak, limit - index);
+        for (; index < limit; ++index)
+            f(index);
+    }
+    stats.iterations = end > begin ? end - begin : 0;
+    return stats;
+}
+
 
 /* NOT tested
 void JSGlobalValue::setGCCallback(const std::function<void(JSValue)>& callback) {
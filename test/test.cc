@@ -1,4 +1,8 @@
 #include <jsnipp.h>
+#include <stdio.h>
+#include <memory>
+#include <stdexcept>
+#include <vector>
 
 using namespace jsni;
 
@@ -12,6 +16,27 @@ JSValue SayHello(JSObject, JSArray args) {
     return JSString("Hello, world");
 }
 
+// C++ exceptions become JavaScript errors
+JSValue CharAt(JSObject, JSArray args) {
+    std::string str = args[0].as(String);
+    if (!args[1].is(Number))
+        throw std::invalid_argument("index is not a number");
+    return JSString(std::string(1, str.at(args[1].as(Number))));
+}
+
+// overloads dispatched by argument types
+double Twice(double x) {
+    return x * 2;
+}
+std::string Twice(const std::string& str) {
+    return str + str;
+}
+void Twice(JSTypedArray<float> array) {
+    float* data = array.buffer();
+    for (size_t i = 0; i < array.length(); ++i)
+        data[i] *= 2;
+}
+
 class Echo {
 public:
     // constuctor
@@ -55,6 +80,62 @@ private:
     std::string prefix_;
 };
 
+constexpr JSClassMember<Echo> echo_members[] = {
+    JSClassMember<Echo>::method<&Echo::echo>("echo"),
+    JSClassMember<Echo>::property<&Echo::prefix>("prefix"),
+    JSClassMember<Echo>::property<&Echo::prefix, &Echo::set_prefix>("prefix2"),
+    JSClassMember<Echo>::constant("version", 1),
+    JSClassMember<Echo>::constant("string", "hello"),
+};
+
+// derived class shares the prototype of Echo
+class LoudEcho : public Echo {
+public:
+    using Echo::Echo;
+    JSValue shout(JSObject self, JSArray args) {
+        return JSString(std::string(echo(self, args).to(String)) + "!");
+    }
+    static JSValue loudness(JSObject, JSArray) {
+        return JSNumber(11);
+    }
+};
+
+constexpr JSClassMember<LoudEcho> loud_echo_members[] = {
+    JSClassMember<LoudEcho>::method<&LoudEcho::shout>("shout"),
+};
+constexpr JSClassMember<LoudEcho> loud_echo_statics[] = {
+    JSClassMember<LoudEcho>::staticMethod<&LoudEcho::loudness>("loudness"),
+    JSClassMember<LoudEcho>::constant("MAX", 11),
+};
+
+// asynchronous function
+class Sum : public JSAsyncTask {
+public:
+    Sum(JSObject, JSArray args) {
+        for (size_t i = 0; i < args.length(); ++i)
+            values_.push_back(args[i].to(Number));
+    }
+    void execute() override {
+        for (auto v: values_)
+            sum_ += v;
+    }
+    JSValue result() override {
+        return JSNumber(sum_);
+    }
+private:
+    std::vector<double> values_;
+    double sum_ = 0;
+};
+
+class Delay : public JSAsyncTask {
+public:
+    Delay(Echo&, JSObject, JSArray) {}
+    void execute() override {
+        if (cancelled())
+            fail("timeout");
+    }
+};
+
 // JSNI Entry point
 __attribute__ ((visibility("default")))
 int JSNI_Init(JSNIEnv* env, JSValueRef exports) {
@@ -63,14 +144,45 @@ int JSNI_Init(JSNIEnv* env, JSValueRef exports) {
 
     // register native function
     jsobj.setProperty("sayHello", JSNativeFunction<SayHello>());
+    jsobj.setProperty("charAt", JSNativeFunction<CharAt>());
+    jsobj.setProperty("twice", JSNativeOverloadedFunction<
+        JSOverload<double (*)(double), &Twice>,
+        JSOverload<std::string (*)(const std::string&), &Twice>,
+        JSOverload<void (*)(JSTypedArray<float>), &Twice>>("twice"));
     //JSNIRegisterMethod(env, exports, "sayHello", SayHello);
+    jsobj.setProperty("sum", JSNativeAsyncFunction<Sum>("sum"));
 
     // register native constructor
     jsobj.setProperty("Echo", JSNativeConstructor<Echo>("Echo", &Echo::setup));
     jsobj.setProperty("Echo", JSNativeConstructor<Echo>{
         {"echo", JSNativeMethod<Echo, &Echo::echo>()},
         {"string", "hello"},
+        {"delay", JSNativeAsyncMethod<Echo, Delay>()},
+    });
+    jsobj.setProperty("Echo", JSClassSpec<Echo>(echo_members).constructor("Echo"));
+    jsobj.setProperty("Echo", JSNativeClass<Echo>(echo_members).define());
+    jsobj.setProperty("LoudEcho", JSNativeClass<LoudEcho, Echo>(
+            loud_echo_members, loud_echo_statics).define());
+
+    // wrap natives in bulk
+    std::vector<std::shared_ptr<Echo>> echoes(
+            3, std::make_shared<Echo>(jsobj, JSArray()));
+    jsobj.setProperty("echoes", JSNativeConstructor<Echo>::wrapAll(
+            echoes.begin(), echoes.end()));
+
+    // one wrapper per native
+    Echo* echo = new Echo(jsobj, JSArray());
+    jsobj.setProperty("echo", JSNativeConstructor<Echo>::wrapUnique(echo));
+    jsobj.setProperty("sameEcho", JSNativeConstructor<Echo>::wrapUnique(echo));
+    JSNativeConstructor<Echo>::enableDispose();
+    JSNativeConstructor<Echo>::wrapUnique(echo).dispose();
+
+    // memory accounting
+    JSNativeStats<Echo>::setHighWaterMark(1 << 20, [](
+            const JSNativeStats<Echo>::Snapshot& stats) {
+        printf("%zu Echo objects use %zu bytes\n", stats.live, stats.bytes);
     });
+    jsobj.setProperty("echoStats", JSNativeConstructor<Echo>::statsFunction());
 
     /* register native object
     Test* native = new Test();
@@ -1,8 +1,45 @@
 #include "jsnipp.h"
 #include <forward_list>
 #include <map>
+#include <vector>
 
 using namespace jsni;
+
+struct Point {
+    double x;
+    double y;
+};
+struct Shape {
+    std::string name;
+    std::vector<Point> points;
+    bool closed;
+};
+namespace jsni {
+template <> struct JSReflection<Point> {
+    static constexpr auto fields() {
+        return std::make_tuple(field("x", &Point::x), field("y", &Point::y));
+    }
+};
+template <> struct JSReflection<Shape> {
+    static constexpr auto fields() {
+        return std::make_tuple(field("name", &Shape::name),
+                               field("points", &Shape::points),
+                               field("closed", &Shape::closed));
+    }
+};
+}
+
+#if defined(__cpp_impl_coroutine)
+JSTask coroutine(JSGlobalValue target) {
+    co_await resume_on_worker();
+    double sum = 0;
+    for (int i = 0; i < 100; ++i)
+        sum += i;
+    co_await resume_on_js();
+    JSObject(target).setProperty("sum", sum);
+}
+#endif
+
 int main() {
     JSNIEnv* env = nullptr;
     initialize(env);
@@ -24,6 +61,14 @@ int main() {
     JSGlobalValue gg = g;
     (void)(jsgval == jsval1);
     (void)(jsgval != jsval1);
+    std::vector<JSGlobalValue> jsgvals(10, jsgval);
+    JSUnsafeGlobalValue ugval(jsval);
+    auto ugval1 = ugval;
+    (void)(JSGlobalValue::live_count() > 0);
+    {
+        JSEnvironmentScope scope(env);
+        (void)jsgval.environment();
+    }
 
     JSNull null;
     JSUndefined undefined;
@@ -103,6 +148,79 @@ int main() {
     (void)obj1["a"];
     obj1["a"] = 100.0;
     obj1["a"] = obj1["b"];
+    (void)obj1.keys().length();
+    (void)obj1.getOwnPropertyNames();
+    obj2.assign(obj1, obj3).freeze();
+    (void)(obj2.isFrozen() && obj2.isExtensible());
+    auto obj6 = JSObject::create(obj1);
+
+    // object template
+    JSObjectTemplate point { "x", "y", "label" };
+    auto pt = point.newInstance(1.0, 2, "a");
+    std::vector<std::tuple<double, double, std::string>> rows(10);
+    auto pts = point.newInstances(rows);
+    auto pts1 = point.newInstances(rows, [](const decltype(rows)::value_type& r) {
+        return std::make_tuple(std::get<1>(r), std::get<0>(r), "b");
+    });
+
+    // reflection
+    Shape shape { "triangle", { {0, 0}, {1, 0}, {0, 1} }, true };
+    JSValue jsshape = to_js(shape);
+    auto shape1 = from_js<Shape>(jsshape);
+    auto jsshapes = to_js(std::vector<Shape>(10, shape1));
+    (void)from_js<std::vector<Shape>>(jsshapes);
+    std::map<std::string, std::vector<Shape>> shapes { {"a", {shape}} };
+    (void)from_js<decltype(shapes)>(to_js(shapes));
+    std::string json = JSON::stringify(shapes);
+    JSON::crossover() = 100;
+    (void)JSON::convert(std::vector<Shape>(1000, shape));
+    (void)JSON::parse(json);
+    JSValueBuilder builder;
+    builder.StartObject();
+    builder.Key("list", 4, false);
+    builder.StartArray();
+    builder.Int(1);
+    builder.String("two", 3, false);
+    builder.Null();
+    builder.EndArray(3);
+    builder.EndObject(1);
+    if (builder.done())
+        (void)builder.result();
+
+    // JavaScript exceptions are checked once for several calls
+    try {
+        JSFunction f("a", "return a.b.c;");
+        f(JSObject());
+        f(JSNull());
+        JSException::check();
+    } catch (const JSError& e) {
+        if (e.pending())  JSException::clear();
+    }
+
+    // binary serialization
+    std::string bin = JSBinary::encode(builder.result());
+    (void)JSBinary::decode(bin);
+    {
+        std::vector<char> out;
+        JSBinaryWriter writer([&out](const char* data, size_t size) {
+            out.insert(out.end(), data, data + size);
+        });
+        writer.write(jsshapes);
+        writer.flush();
+        JSBinaryReader reader(out.data(), out.size(), true);
+        JSValue shapes2 = reader.read();
+        if (reader.failed())  (void)shapes2;
+    }
+
+    // columnar export
+    struct Row { double price; int volume; bool up; std::string symbol; };
+    std::vector<Row> table(1000, Row { 1.5, 100, true, "ABC" });
+    auto columns = JSColumnExporter<Row>()
+        .numeric("price", &Row::price)
+        .numeric("volume", &Row::volume)
+        .numeric("up", &Row::up)
+        .dictionary("symbol", &Row::symbol)(table);
+    (void)columns["price"].is(Float64Array);
 
     // AssociatedObject
     auto jsaobj = JSAssociatedObject(10);
@@ -127,6 +245,25 @@ int main() {
     arr.getElement<JSObject>(1);
     arr[1] = 100;  // ?? effective?
     arr[1] = arr[2];
+    double total = 0;
+    auto stats = arr.forEach([&](JSValue v, size_t) {
+        total += v.to(Number);
+    }, 2);
+    (void)(stats.peak <= 2);
+    JSObject escaped;
+    {
+        JSEscapableScope scope;
+        escaped = scope.escape(JSObject{{"a", 1}});
+    }
+
+    // cache
+    JSPersistentCache<std::string> cache(100, 1 << 20);
+    cache.put("obj1", obj1, 64);
+    cache.put("obj2", obj2, 64, true);
+    (void)cache.get("obj1");
+    (void)cache.get("obj3", []() { return JSObject(); });
+    (void)(cache.stats().hits == 1);
+    cache.erase("obj2");
 
     // typedarray
     unsigned char buf[100];
@@ -134,12 +271,25 @@ int main() {
     (void)tarr.length();
     (void)(tarr.buffer() == buf);
     auto tarr1 = JSTypedArray<float>();
+    auto tarr4 = JSTypedArray<float>(new float[10], 10, [](float* p) {
+        delete[] p;
+    });
+    auto tarr5 = JSTypedArray<double>(std::vector<double>(10));
     //auto tarr2 = JSTypedArray<char*>();
 
     // function
     auto jsfun = JSFunction(tarr);  // FIXME
     auto jsfun1 = JSFunction(jsval, nullptr);
     jsfun(nullptr, 1, 2.3, "asf", true);
+    JSMethodHandle emit(obj1, "emit");
+    for (int i = 0; i < 3; ++i)
+        emit("event", i, jsgval);
+    emit.resolve();
+
+#if defined(__cpp_impl_coroutine)
+    // coroutine
+    coroutine(JSGlobalValue(obj));
+#endif
 
     return 0;
 }